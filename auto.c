@@ -4,19 +4,36 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include "auto.h"
 #include "regex.h"
 #include "stack.h"
 #include "ops.h"
+#include "dfa.h"
+#include "nfa.h"
+#include "sink.h"
+#include "batch.h"
+#include "image.h"
+#include "search.h"
+#include "pda.h"
+#include "chart.h"
 
 int flag_verbose = 0;
+int flag_chart = 0;
+int num_threads = 1;
+long lazy_budget = 0;
 double delay = 0;
 int execute = 0;
 char tm_blank = '_';
 char tm_bound = '\0';
 int tm_bound_halt = 0;
+int tm_explore = EXPLORE_BFS;
+struct Budget budget = { 0, 0, 0, 0 };
 
 struct State *State_create(char *name)
 {
@@ -33,9 +50,12 @@ struct State *State_create(char *name)
 		exit(EXIT_FAILURE);
 	}
 	state->name = strdup(name);
+	state->id = -1;
 	state->start = 0;
 	state->final = 0;
 	state->reject = 0;
+	state->tags = NULL;
+	state->num_tags = 0;
 	state->cmd = NULL;
 	//state->cmd_args = NULL;
 	state->cmd_args = malloc(sizeof(char *));
@@ -55,6 +75,14 @@ struct Automaton *Automaton_create()
 	}
 	automaton->len = 0;
 	automaton->max_len = 2;
+	automaton->start = NULL;
+	automaton->table = NULL;
+	automaton->nfa = NULL;
+	automaton->lazy = NULL;
+	automaton->search = NULL;
+	automaton->pda = NULL;
+	automaton->chart = NULL;
+	automaton->prepared = 0;
 	automaton->states = malloc(sizeof(struct State *) * automaton->max_len);
 	if (automaton->states == NULL) {
 		fprintf(stderr, "Error allocating memory for states array in automaton\n");
@@ -63,6 +91,31 @@ struct Automaton *Automaton_create()
 	return automaton;
 }
 
+// Add a pattern id to the state, keeping its tags sorted and unique
+void State_tag(struct State *state, int tag)
+{
+	int i = 0;
+	while (i < state->num_tags && state->tags[i] < tag) i++;
+	if (i < state->num_tags && state->tags[i] == tag) return;
+	state->tags = realloc(state->tags, sizeof(int) * (state->num_tags + 1));
+	if (state->tags == NULL) {
+		fprintf(stderr, "Memory error adding tag to state\n");
+		exit(EXIT_FAILURE);
+	}
+	memmove(state->tags + i + 1, state->tags + i, sizeof(int) * (state->num_tags - i));
+	state->tags[i] = tag;
+	state->num_tags++;
+}
+
+// Returns 1 if both states accept the same patterns
+int State_tags_equal(struct State *s0, struct State *s1)
+{
+	if (s0->num_tags != s1->num_tags) return 0;
+	for (int i = 0; i < s0->num_tags; i++)
+		if (s0->tags[i] != s1->tags[i]) return 0;
+	return 1;
+}
+
 struct State* State_get(struct Automaton *automaton, char *name)
 {
 	for (int i = 0; i < automaton->len; i++) {
@@ -152,6 +205,7 @@ void State_destroy(struct State *state)
 		free(state->cmd_args[i]);
 	}
 	free(state->cmd_args);
+	free(state->tags);
 	free(state->name);
 	free(state->trans);
 	free(state);
@@ -163,6 +217,12 @@ void Automaton_destroy(struct Automaton *automaton)
 	for (int i = 0; i < automaton->len; i++) {
 		State_destroy(automaton->states[i]);
 	}
+	if (automaton->table != NULL) DFATable_destroy(automaton->table);
+	if (automaton->lazy != NULL) LazyDFA_destroy(automaton->lazy);
+	if (automaton->nfa != NULL) NFATable_destroy(automaton->nfa);
+	if (automaton->search != NULL) Search_destroy(automaton->search);
+	if (automaton->pda != NULL) PDATable_destroy(automaton->pda);
+	if (automaton->chart != NULL) PDAChart_destroy(automaton->chart);
 	free(automaton->states);
 	free(automaton);
 }
@@ -170,6 +230,12 @@ void Automaton_destroy(struct Automaton *automaton)
 // Destroy automaton struct only
 void Automaton_clear(struct Automaton *automaton)
 {
+	if (automaton->table != NULL) DFATable_destroy(automaton->table);
+	if (automaton->lazy != NULL) LazyDFA_destroy(automaton->lazy);
+	if (automaton->nfa != NULL) NFATable_destroy(automaton->nfa);
+	if (automaton->search != NULL) Search_destroy(automaton->search);
+	if (automaton->pda != NULL) PDATable_destroy(automaton->pda);
+	if (automaton->chart != NULL) PDAChart_destroy(automaton->chart);
 	free(automaton->states);
 	free(automaton);
 }
@@ -239,6 +305,8 @@ void State_print(struct State *state)
 	if (state->reject) printf(" [R]");
 	if (state->start) printf(" [S]");
 	if (execute && state->cmd) printf(" $(%s)", state->cmd);
+	for (int i = 0; i < state->num_tags; i++)
+		printf(i == 0 ? " # %d" : ",%d", state->tags[i]);
 
 	printf("\n");
 }
@@ -338,6 +406,8 @@ struct Automaton *Automaton_import(char *filename)
 	size_t len = 0;
 	ssize_t read;
 
+	if (isimage(filename)) return Automaton_load(filename);
+
 	fp = fopen(filename, "r");
 	if (fp == NULL) { 
 		fprintf(stderr, "Error opening %s\n", filename);
@@ -1604,6 +1674,7 @@ struct Automaton *Automaton_import(char *filename)
 	
 	// Sort states in alpha order
 	qsort(automaton->states, automaton->len, sizeof(struct State *), State_compare);
+	Automaton_compile(automaton);
 	
 	return automaton;
 }
@@ -1660,10 +1731,183 @@ int isDFA(struct Automaton *automaton)
 
 }
 
-int DFA_run(struct Automaton *automaton, char *input)
+// Returns 1 for a stackless machine without empty string transitions that
+// has at most one transition per symbol from each state: a DFA that may
+// be missing transitions
+int isPartialDFA(struct Automaton *automaton)
 {
-	//if (flag_verbose) Automaton_print(automaton);
+	int seen[256];
+	memset(seen, -1, sizeof(seen));
+	for (int i = 0; i < automaton->len; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			unsigned char c = (unsigned char)trans->symbol;
+			if (c == '\0' || trans->readsym != '\0' || trans->writesym != '\0' ||
+					trans->direction != '\0' || seen[c] == i)
+				return 0;
+			seen[c] = i;
+		}
+	}
+	return 1;
+}
+
+static int State_pointer_compare(const void *a, const void *b)
+{
+	struct State *s0 = *(struct State **)a;
+	struct State *s1 = *(struct State **)b;
+	return (s0 > s1) - (s0 < s1);
+}
+
+// The states of automaton sorted by address, for State_index. Code that
+// may run on several threads at once numbers states this way instead of
+// borrowing their ids
+static struct State **States_sorted(struct Automaton *automaton)
+{
+	int len = automaton->len;
+	struct State **sorted = malloc(sizeof(struct State *) * (len > 0 ? len : 1));
+	if (sorted == NULL) {
+		fprintf(stderr, "Error allocating memory for sorted states\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len; i++) sorted[i] = automaton->states[i];
+	qsort(sorted, len, sizeof(struct State *), State_pointer_compare);
+	return sorted;
+}
 
+// Place of state among the len states of sorted
+static int State_index(struct State **sorted, int len, struct State *state)
+{
+	struct State **found = bsearch(&state, sorted, len, sizeof(struct State *), State_pointer_compare);
+	return found - sorted;
+}
+
+// Returns 1 for a PDA that has at most one move from any state, input
+// symbol and top of stack: no two transitions from a state overlap on the
+// input and on the stack (reading nothing overlaps every top). An empty
+// string transition may overlap symbol transitions only if no input can
+// be read after it, so it only matters once the input has run out. The
+// empty string transitions must also have no cycles, so a run of them
+// always ends.
+int isDPDA(struct Automaton *automaton)
+{
+	int len = automaton->len;
+	struct State **sorted = States_sorted(automaton);
+	int *indegree = calloc(len > 0 ? len : 1, sizeof(int));
+	int *order = malloc(sizeof(int) * (len > 0 ? len : 1));
+	char *reads = malloc(sizeof(char) * (len > 0 ? len : 1));
+	if (indegree == NULL || order == NULL || reads == NULL) {
+		fprintf(stderr, "Error allocating memory for isDPDA\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	// Order the states so empty string transitions only go forward,
+	// removing states with none left coming in
+	for (int i = 0; i < len; i++) {
+		struct State *state = sorted[i];
+		for (int j = 0; j < state->num_trans; j++)
+			if (state->trans[j]->symbol == '\0')
+				indegree[State_index(sorted, len, state->trans[j]->state)]++;
+	}
+	int num_order = 0;
+	for (int i = 0; i < len; i++)
+		if (indegree[i] == 0) order[num_order++] = i;
+	for (int k = 0; k < num_order; k++) {
+		struct State *state = sorted[order[k]];
+		for (int j = 0; j < state->num_trans; j++) {
+			if (state->trans[j]->symbol != '\0') continue;
+			int t = State_index(sorted, len, state->trans[j]->state);
+			if (--indegree[t] == 0) order[num_order++] = t;
+		}
+	}
+	int deterministic = num_order == len;
+	
+	// reads[i] is 1 if input can be read from state i, maybe after some
+	// empty string transitions
+	for (int k = num_order - 1; k >= 0; k--) {
+		struct State *state = sorted[order[k]];
+		reads[order[k]] = 0;
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			if (trans->symbol != '\0' || reads[State_index(sorted, len, trans->state)])
+				reads[order[k]] = 1;
+		}
+	}
+	
+	for (int i = 0; i < len && deterministic; i++) {
+		struct State *state = sorted[i];
+		for (int j = 0; j < state->num_trans && deterministic; j++) {
+			struct Transition *a = state->trans[j];
+			if (a->direction != '\0') deterministic = 0;
+			for (int k = j + 1; k < state->num_trans && deterministic; k++) {
+				struct Transition *b = state->trans[k];
+				if (a->readsym != b->readsym && a->readsym != '\0' && b->readsym != '\0')
+					continue;
+				if (a->symbol == b->symbol)
+					deterministic = 0;
+				else if (a->symbol == '\0' && reads[State_index(sorted, len, a->state)])
+					deterministic = 0;
+				else if (b->symbol == '\0' && reads[State_index(sorted, len, b->state)])
+					deterministic = 0;
+			}
+		}
+	}
+	
+	free(sorted);
+	free(indegree);
+	free(order);
+	free(reads);
+	return deterministic;
+}
+
+// Build the transition table used by DFA_run, only for machines isDFA accepts.
+// An NFA's bitset table or a PDA's table is dropped here and rebuilt on
+// its next run.
+void Automaton_compile(struct Automaton *automaton)
+{
+	if (automaton->table != NULL) {
+		DFATable_destroy(automaton->table);
+		automaton->table = NULL;
+	}
+	if (automaton->lazy != NULL) {
+		LazyDFA_destroy(automaton->lazy);
+		automaton->lazy = NULL;
+	}
+	if (automaton->nfa != NULL) {
+		NFATable_destroy(automaton->nfa);
+		automaton->nfa = NULL;
+	}
+	if (automaton->pda != NULL) {
+		PDATable_destroy(automaton->pda);
+		automaton->pda = NULL;
+	}
+	if (automaton->chart != NULL) {
+		PDAChart_destroy(automaton->chart);
+		automaton->chart = NULL;
+	}
+	automaton->prepared = 0;
+	if (isDFA(automaton) == 1)
+		automaton->table = DFATable_create(automaton);
+}
+
+// The state the DFA ends in after reading input, or NULL if it dies first
+struct State *DFA_end(struct Automaton *automaton, char *input)
+{
+	//if (flag_verbose) Automaton_print(automaton);
+	if (automaton->table == NULL)
+		automaton->table = DFATable_create(automaton);
+	struct DFATable *table = automaton->table;
+	
+	if (!flag_verbose && !execute && !delay) {
+		int state;
+		if (num_threads > 1)
+			state = DFATable_run_parallel(table, input, strlen(input), num_threads);
+		else
+			state = DFATable_run(table, input);
+		return state >= 0 ? table->states[state] : NULL;
+	}
+	
+	// Traced runs walk the states themselves so every step is shown
 	struct State *state = automaton->start;
 	for (int i = 0; input[i] != '\0'; i++) {
 		if (flag_verbose) printf("[%c]%s:\n", input[i], input+i+1);
@@ -1683,208 +1927,445 @@ int DFA_run(struct Automaton *automaton, char *input)
 		
 		if (delay) nsleep(delay);
 		
-		if (none) {
-			printf("=>%s\n\tREJECTED\n", input);
-			return 0;
+		if (none) return NULL;
+	}
+	return state;
+}
+
+// Returns 1 if the DFA accepts input, without printing the result
+int DFA_accepts(struct Automaton *automaton, char *input)
+{
+	struct State *state = DFA_end(automaton, input);
+	return state != NULL && state->final;
+}
+
+int DFA_run(struct Automaton *automaton, char *input)
+{
+	struct State *state = DFA_end(automaton, input);
+	Sink_state(&result_sink, input, strlen(input), state);
+	return state != NULL && state->final;
+}
+
+// Set the budget from a spec like "steps=1000,configs=1m,time=2.5". Counts
+// take the same k, m and g suffixes as -L. Returns 0, or -1 if it is bad
+int Budget_parse(char *spec)
+{
+	char *copy = strdup(spec);
+	int status = 0;
+	for (char *item = strtok(copy, ","); item != NULL && status == 0; item = strtok(NULL, ",")) {
+		char *value = strchr(item, '=');
+		if (value == NULL) {
+			status = -1;
+			break;
+		}
+		*value++ = '\0';
+		char *suffix;
+		if (!strcmp(item, "time")) {
+			budget.seconds = strtod(value, &suffix);
+			if (*suffix != '\0' || budget.seconds <= 0) status = -1;
+			continue;
 		}
+		long count = strtol(value, &suffix, 10);
+		if (*suffix == 'k' || *suffix == 'K') count <<= 10;
+		else if (*suffix == 'm' || *suffix == 'M') count <<= 20;
+		else if (*suffix == 'g' || *suffix == 'G') count <<= 30;
+		else if (*suffix != '\0') status = -1;
+		if (*suffix != '\0' && suffix[1] != '\0') status = -1;
+		if (count < 1) status = -1;
+		if (!strcmp(item, "steps")) budget.steps = count;
+		else if (!strcmp(item, "configs")) budget.configs = count;
+		else if (!strcmp(item, "length")) budget.length = count;
+		else status = -1;
 	}
-	if (state->final) {
-		printf("=>%s\n\tACCEPTED\n", input);
-		return 1;
-	} else {
-		printf("=>%s\n\tREJECTED\n", input);
-		return 0;
+	free(copy);
+	return status;
+}
+
+static double Budget_clock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// 1 if a run begun at start has gone over the budget
+static int Budget_over(long steps, long configs, long length, double start)
+{
+	if (budget.steps > 0 && steps > budget.steps) return 1;
+	if (budget.configs > 0 && configs > budget.configs) return 1;
+	if (budget.length > 0 && length > budget.length) return 1;
+	if (budget.seconds > 0 && Budget_clock() - start > budget.seconds) return 1;
+	return 0;
+}
+
+// Budget_over for a PDA run, where set has just had a configuration added
+static int ConfigSet_over(struct ConfigSet *set, long steps, double start)
+{
+	struct StackNode *stack = set->configs[set->len-1].stack;
+	return Budget_over(steps, set->len, stack != NULL ? stack->depth : 0, start);
+}
+
+// Apply trans to a configuration of its source state holding stack, and
+// add the result to target. Returns 1 if the move applies and is new
+static int Machine_advance(struct StackGraph *graph, struct ConfigSet *target,
+	struct StackNode *stack, struct Transition *trans)
+{
+	// read/pop
+	if (trans->readsym != '\0') {
+		if (stack == NULL || stack->symbol != trans->readsym) return 0;
+		stack = stack->parent;
 	}
+	// write/push
+	if (trans->writesym != '\0') stack = StackGraph_push(graph, stack, trans->writesym);
+	return ConfigSet_add(target, trans->state, stack);
 }
 
-int Machine_advance(struct MultiStackList *source, struct MultiStackList *target, 
-	struct Automaton *automaton, struct State *state, struct Transition *trans)
+// Verbose line for a move from state to config. Stacks are only shown
+// for machines that use them
+static void Machine_advance_print(struct State *state, struct PDAConfig *config, int stacks)
 {
-	// STACK OPERATIONS
-	char readsym = trans->readsym;
-	char writesym = trans->writesym;
-	struct MultiStack *mstmp = MultiStack_get(source, state);
-	
-	// do not push or pop
-	if (readsym == '\0' && writesym == '\0') {
-		if (mstmp != NULL) {
-			for (int l = 0; l < mstmp->len; l++) {
-				struct Stack *copy = Stack_copy(mstmp->stacks[l]);
-				Stack_add_to(target, trans->state, copy);
-			}
+	printf("\t%s > %s", state->name, config->state->name);
+	if (config->state->final) printf(" [F]");
+	if (stacks) {
+		putchar(' ');
+		StackNode_print(config->stack);
+	}
+	printf("\n");
+}
+
+// Add every configuration reachable from those in set by empty string
+// transitions. Returns 1 if that goes over the budget, which empty string
+// transitions that keep pushing always do
+static int Machine_closure(struct StackGraph *graph, struct ConfigSet *set, int stacks, int print,
+	long steps, double start)
+{
+	for (int i = 0; i < set->len; i++) {
+		struct State *state = set->configs[i].state;
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			if (trans->symbol != '\0') continue;
+			if (!Machine_advance(graph, set, set->configs[i].stack, trans)) continue;
+			if (print) Machine_advance_print(state, &set->configs[set->len-1], stacks);
+			if (ConfigSet_over(set, steps, start)) return 1;
 		}
-		State_add(automaton, trans->state);
-		return 1;
-	// write/push
-	} else if (trans->readsym == '\0' && trans->writesym != '\0') {
-		if (mstmp != NULL) {
-			for (int l = 0; l < mstmp->len; l++) {
-				struct Stack *copy = Stack_copy(mstmp->stacks[l]);
-				Stack_push(copy, trans->writesym);
-				Stack_add_to(target, trans->state, copy);
+	}
+	return 0;
+}
+
+// Tables for untraced runs of a stackless NFA: a DFATable when no state
+// has a choice to make, otherwise the bitset NFATable. A deterministic
+// PDA gets a PDATable instead, and any PDA gets a PDAChart with -E. The
+// choice is made once, even when no table applies
+void NFA_prepare(struct Automaton *automaton)
+{
+	if (automaton->prepared) return;
+	automaton->prepared = 1;
+	if (automaton->table != NULL || automaton->nfa != NULL || automaton->pda != NULL ||
+			automaton->chart != NULL) return;
+	if (isPartialDFA(automaton))
+		automaton->table = DFATable_create(automaton);
+	else if (isDFA(automaton) == 2 && flag_chart)
+		automaton->chart = PDAChart_create(automaton);
+	else if (isDFA(automaton) == 2 && isDPDA(automaton))
+		automaton->pda = PDATable_create(automaton);
+	else
+		automaton->nfa = NFATable_create(automaton);
+}
+
+// Untraced run of a stackless NFA, through the lazy DFA when -L is given
+static int NFA_accepts(struct Automaton *automaton, char *input, size_t len)
+{
+	if (automaton->table != NULL) {
+		struct DFATable *table = automaton->table;
+		int state = DFATable_step(table, table->start, input, len);
+		return state >= 0 && table->final[state];
+	}
+	if (lazy_budget > 0) {
+		if (automaton->lazy == NULL)
+			automaton->lazy = LazyDFA_create(automaton->nfa, lazy_budget);
+		return LazyDFA_accepts(automaton->lazy, input, len);
+	}
+	return NFATable_accepts(automaton->nfa, input, len);
+}
+
+// Returns 1 if the NFA/PDA accepts input, without printing the result
+int Automaton_accepts(struct Automaton *automaton, char *input)
+{
+	// Untraced runs of stackless NFAs use the bitset engine
+	if (!flag_verbose && !execute && !delay) {
+		NFA_prepare(automaton);
+		if (automaton->table != NULL || automaton->nfa != NULL)
+			return NFA_accepts(automaton, input, strlen(input));
+		if (automaton->pda != NULL)
+			return PDATable_accepts(automaton->pda, input, strlen(input));
+		if (automaton->chart != NULL)
+			return PDAChart_accepts(automaton->chart, input, strlen(input));
+	}
+	
+	// Branches share their stacks through one graph, and each step's
+	// configurations are deduplicated as they are added
+	int stacks = 0;
+	for (int i = 0; i < automaton->len && !stacks; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans && !stacks; j++)
+			stacks = state->trans[j]->readsym != '\0' || state->trans[j]->writesym != '\0';
+	}
+	struct StackGraph *graph = StackGraph_create();
+	struct ConfigSet *current = ConfigSet_create();
+	struct ConfigSet *next = ConfigSet_create();
+	double start = Budget_clock();
+	
+	ConfigSet_add(current, automaton->start, NULL);
+	if (flag_verbose && input[0] == '\0') printf("[]%s:\n", input);
+	int over = Machine_closure(graph, current, stacks, flag_verbose && input[0] == '\0', 0, start);
+	
+	// Iterate through each input char
+	for (int i = 0; input[i] != '\0' && current->len > 0 && !over; i++) {
+		if (flag_verbose) printf("[%c]%s:\n", input[i], input+i+1);
+		
+		for (int j = 0; j < current->len && !over; j++) {
+			struct State *state = current->configs[j].state;
+			for (int k = 0; k < state->num_trans && !over; k++) {
+				struct Transition *trans = state->trans[k];
+				if (trans->symbol != input[i]) continue;
+				if (!Machine_advance(graph, next, current->configs[j].stack, trans)) continue;
+				if (flag_verbose) Machine_advance_print(state, &next->configs[next->len-1], stacks);
+				over = ConfigSet_over(next, i + 1, start);
 			}
-		} else {
-			struct Stack *new_stack = Stack_create();
-			Stack_push(new_stack, trans->writesym);
-			Stack_add_to(target, trans->state, new_stack);
-			
 		}
+		if (!over) over = Machine_closure(graph, next, stacks, flag_verbose, i + 1, start);
 		
-		State_add(automaton, trans->state);
-		return 1;
-	// read/pop (and possibly write/push)
-	} else if (trans->readsym != '\0') {
-		if (mstmp != NULL) {
-			int state_added = 0;
-			for (int l = 0; l < mstmp->len; l++) {
-				if (Stack_peek(mstmp->stacks[l]) == trans->readsym) {
-					if (!state_added) {
-						State_add(automaton, trans->state);
-						state_added = 1;
-					}
-					
-					struct Stack *copy = Stack_copy(mstmp->stacks[l]);
-					Stack_pop(copy);
-					if (trans->writesym != '\0') Stack_push(copy, trans->writesym);
-					Stack_add_to(target, trans->state, copy);
-					
-				}
-			}
-			return state_added;
+		// Commands run once per state reached
+		for (int j = 0; execute && j < next->len; j++) {
+			struct State *state = next->configs[j].state;
+			if (state->cmd == NULL) continue;
+			int seen = 0;
+			for (int k = 0; k < j && !seen; k++) seen = next->configs[k].state == state;
+			if (!seen) State_cmd_run(state);
 		}
+		
+		if (delay) nsleep(delay);
+		
+		struct ConfigSet *tmp = current;
+		current = next;
+		next = tmp;
+		ConfigSet_clear(next);
 	}
+	
+	int accepted = over ? VERDICT_LIMIT : 0;
+	for (int i = 0; i < current->len && !accepted; i++) {
+		if (current->configs[i].state->final) accepted = 1;
+	}
+	ConfigSet_destroy(current);
+	ConfigSet_destroy(next);
+	StackGraph_destroy(graph);
+	return accepted;
 }
 
 int Automaton_run(struct Automaton *automaton, char *input)
 {
-	struct Automaton *current_states = Automaton_create();
-	struct MultiStackList *current_stacks = MultiStackList_create();
-	struct Automaton *next_states;
-	struct MultiStackList *next_stacks;
-	
-	//if (flag_verbose) putchar('\n');
-	
-	// Add empty string transitions to current array
-	State_add(current_states, automaton->start);
-	int printed_string = 0;
-	if (input[0] == '\0') {
-		for (int i = 0; i < current_states->len; i++) {
-			struct State *state = current_states->states[i];
-			for (int j = 0; j < state->num_trans; j++) {
-				struct Transition *trans = state->trans[j];
-				if (state->trans[j]->symbol == '\0') {
-					int added = Machine_advance(current_stacks, current_stacks, current_states, state, trans);
-					if (added && flag_verbose) {
-						if (!printed_string) {
-							printf("[]%s:\n", input);
-							printed_string = 1;
-						}
-						printf("\t%s > %s", state->name, trans->state->name);
-						if (trans->state->final) printf(" [F]"); //else printf("\n");
-						struct MultiStack *mstmp = MultiStack_get(current_stacks, trans->state);
-						if (mstmp) {
-							for (int k = 0; k < mstmp->len; k++)
-								printf(" %s", mstmp->stacks[k]->stack);
-						}
-						printf("\n");
-					}
-				}
-			}
+	int accepted = Automaton_accepts(automaton, input);
+	Sink_result(&result_sink, input, strlen(input), accepted);
+	return accepted != 1;
+}
+
+// State_add for the states of one TM step. sorted holds the machine's
+// states in address order, and marks[i] is stamp once sorted[i] has been
+// added, so there is no scan for duplicates
+static int State_add_marked(struct Automaton *states, struct State **sorted, int len,
+	int *marks, int stamp, struct State *state)
+{
+	int i = State_index(sorted, len, state);
+	if (marks[i] == stamp) return 0;
+	marks[i] = stamp;
+	states->len++;
+	if (states->len > states->max_len) {
+		states->max_len *= 2;
+		states->states = realloc(states->states, sizeof(struct State *) * states->max_len);
+		if (states->states == NULL) {
+			fprintf(stderr, "Memory error adding state name to automaton\n");
+			exit(EXIT_FAILURE);
 		}
 	}
+	states->states[states->len-1] = state;
+	return 1;
+}
+
+// One configuration of a depth first TM run, its depth in the run, and
+// the next of its state's transitions to try
+struct TMFrame {
+	struct State *state;
+	struct Stack *tape;
+	int depth;
+	int next;
+};
+
+// Depth first TM run for -t dfs and iddfs. Only the configurations on the
+// current path are kept, each with its own tape. A bfs run only stops at
+// reject states once every branch of a step is in one, so a branch that
+// reaches a reject state is held until some branch reaches the same depth
+// outside one, and the run rejects if that never happens. iddfs stops
+// every branch at a depth that doubles each round until a round cuts none
+// of them off
+static int TuringMachine_search(struct Automaton *automaton, char *input)
+{
+	double start = Budget_clock();
+	long steps = 0;
+	int limit = tm_explore == EXPLORE_IDDFS ? 1 : 0;
+	int len = 0;
+	int max_len = 16;
+	struct TMFrame *path = malloc(sizeof(struct TMFrame) * max_len);
+	// Branches held in reject states, and the depths some branch has
+	// reached outside one
+	int num_held = 0;
+	int max_held = 16;
+	struct TMFrame *held = malloc(sizeof(struct TMFrame) * max_held);
+	int max_depth = 16;
+	char *open = malloc(sizeof(char) * max_depth);
+	if (path == NULL || held == NULL || open == NULL) {
+		fprintf(stderr, "Error allocating memory for TM search path\n");
+		exit(EXIT_FAILURE);
+	}
 	
-	// Iterate through each input char
-	for (int i = 0; input[i] != '\0'; i++) {
-		
-		next_states = Automaton_create();
-		next_stacks = MultiStackList_create();
-		
-		if (flag_verbose) printf("[%c]%s:\n", input[i], input+i+1);
+	int accepted = 0;
+	int done = 0;
+	while (!done) {
+		if (flag_verbose) printf("---------------\n");
+		int cut = 0;
+		memset(open, 0, max_depth);
+		open[0] = 1;
+		held[0].state = automaton->start;
+		held[0].tape = Stack_create();
+		for (int i = 0; input[i] != '\0'; i++) Stack_push(held[0].tape, input[i]);
+		held[0].depth = 0;
+		num_held = 1;
 		
-		for (int j = 0; j < current_states->len; j++) {
-			struct State *state = current_states->states[j];
-			for (int k = 0; k < state->num_trans; k++) {
-				struct Transition *trans = state->trans[k];
+		while (!done) {
+			// Resume a held branch at a depth that is open by now
+			int h = 0;
+			while (h < num_held && !open[held[h].depth]) h++;
+			if (h == num_held) break;
+			path[0] = held[h];
+			path[0].next = 0;
+			held[h] = held[--num_held];
+			len = 1;
+			
+			while (len > 0 && !done) {
+				struct TMFrame *frame = &path[len-1];
+				if (frame->next == frame->state->num_trans || (limit > 0 && frame->depth >= limit)) {
+					if (frame->next < frame->state->num_trans) cut = 1;
+					Stack_destroy(frame->tape);
+					len--;
+					continue;
+				}
+				struct Transition *trans = frame->state->trans[frame->next++];
+				struct Stack *tape = frame->tape;
+				if (trans->symbol != '\0' && trans->symbol != tape->stack[tape->pos]) continue;
+				int depth = frame->depth + 1;
+				if (depth == max_depth) {
+					max_depth *= 2;
+					open = realloc(open, sizeof(char) * max_depth);
+					if (open == NULL) {
+						fprintf(stderr, "Error reallocating memory for TM search path\n");
+						exit(EXIT_FAILURE);
+					}
+					memset(open + depth, 0, max_depth - depth);
+				}
+				// As in bfs, a branch that runs off the tape still counts
+				if (!trans->state->reject) open[depth] = 1;
+				struct Stack *copy = Stack_copy(tape);
+				if (trans->writesym != '\0')
+					Stack_write(copy, trans->writesym);
+				if (Stack_change_pos(copy, trans->direction)) {
+					Stack_destroy(copy);
+					continue;
+				}
+				steps++;
 				
-				if (trans->symbol == '\0') {
-					int added = Machine_advance(current_stacks, current_stacks, current_states, state, trans);
+				if (flag_verbose) {
+					printf("\t%s > %s", frame->state->name, trans->state->name);
+					if (trans->state->final) { printf(" [F]"); }
+					if (trans->state->reject) { printf(" [R]"); }
+					putchar(' ');
+					Stack_print(copy);
+					printf("\n");
 				}
+				if (execute && trans->state->cmd != NULL) State_cmd_run(trans->state);
+				if (delay) nsleep(delay);
 				
-				// Input char match 
-				if (trans->symbol == input[i]) {
-					int added = Machine_advance(current_stacks, next_stacks, next_states, state, trans);
-					if (added && flag_verbose) {
-						printf("\t%s > %s", state->name, trans->state->name);
-						if (trans->state->final) printf(" [F]"); 
-						struct MultiStack *mstmp = MultiStack_get(next_stacks, trans->state);
-						if (mstmp) {
-							for (int k = 0; k < mstmp->len; k++)
-								printf(" %s", mstmp->stacks[k]->stack);
+				if (trans->state->final) {
+					accepted = 1;
+					done = 1;
+				} else if (Budget_over(steps, len + num_held + 1, copy->len, start)) {
+					accepted = VERDICT_LIMIT;
+					done = 1;
+				}
+				if (done) {
+					Stack_destroy(copy);
+					continue;
+				}
+				
+				struct TMFrame next = { trans->state, copy, depth, 0 };
+				if (!open[depth]) {
+					if (num_held == max_held) {
+						max_held *= 2;
+						held = realloc(held, sizeof(struct TMFrame) * max_held);
+						if (held == NULL) {
+							fprintf(stderr, "Error reallocating memory for TM search path\n");
+							exit(EXIT_FAILURE);
 						}
-						printf("\n");
 					}
+					held[num_held++] = next;
+					continue;
 				}
-			}
-		}
-		
-		// Prep next array with empty string transitions
-		for (int j = 0; j < next_states->len; j++) {
-			struct State *state = next_states->states[j];
-			for (int k = 0; k < state->num_trans; k++) {
-				struct Transition *trans = state->trans[k];
-				if (trans->symbol == '\0') {
-					int added = Machine_advance(next_stacks, next_stacks, next_states, state, trans);
-					if (added & flag_verbose) {
-						printf("\t%s > %s", state->name, state->trans[k]->state->name);
-						if (state->trans[k]->state->final) printf(" [F]");
-						struct MultiStack *mstmp = MultiStack_get(next_stacks, trans->state);
-						if (mstmp) {
-							for (int k = 0; k < mstmp->len; k++)
-								printf(" %s", mstmp->stacks[k]->stack);
-						}
-						printf("\n");
+				if (len == max_len) {
+					max_len *= 2;
+					path = realloc(path, sizeof(struct TMFrame) * max_len);
+					if (path == NULL) {
+						fprintf(stderr, "Error reallocating memory for TM search path\n");
+						exit(EXIT_FAILURE);
 					}
 				}
+				path[len++] = next;
 			}
+			
+			for (int i = 0; i < len; i++) Stack_destroy(path[i].tape);
 		}
 		
-		for (int j = 0; j < next_states->len; j++) {
-			if (execute && next_states->states[j]->cmd != NULL) 
-				State_cmd_run(next_states->states[j]);
-		}
-		
-		if (delay) nsleep(delay);
-		
-		Automaton_clear(current_states);
-		MultiStackList_destroy(current_stacks);
-		current_states = next_states;
-		current_stacks = next_stacks;
-		
-		if (current_states->len == 0) {
-			printf("=>%s\n\tREJECTED\n", input);
-			MultiStackList_destroy(current_stacks);
-			Automaton_clear(current_states);
-			return 1;
-		}
+		// A branch still held is at a depth where every branch is in a
+		// reject state, which ends a bfs run however deep the others go
+		if (num_held > 0) cut = 0;
+		for (int i = 0; i < num_held; i++) Stack_destroy(held[i].tape);
+		// Without a cut off branch every branch has been explored
+		if (!cut) done = 1;
+		limit *= 2;
 	}
-	
-	for (int i = 0; i < current_states->len; i++) {
-		if (current_states->states[i]->final) { 
-			printf("=>%s\n\tACCEPTED\n", input);
-			MultiStackList_destroy(current_stacks);
-			Automaton_clear(current_states);
-			return 0;
-		}
-	}
-	Automaton_clear(current_states);
-	MultiStackList_destroy(current_stacks);
-	printf("=>%s\n\tREJECTED\n", input);
-	return 1;
-
+	free(path);
+	free(held);
+	free(open);
+	return accepted;
 }
 
-int TuringMachine_run(struct Automaton *automaton, char *input)
+// Returns 1 if the TM accepts input, without printing the result, or
+// VERDICT_LIMIT if it goes over the budget first
+int TuringMachine_accepts(struct Automaton *automaton, char *input)
 {
+	if (tm_explore != EXPLORE_BFS) return TuringMachine_search(automaton, input);
+	
+	// The states reached in each step are marked by their place among the
+	// states sorted by address. The ids can't be borrowed, since -j runs
+	// TMs on several threads at once
+	int len = automaton->len;
+	struct State **sorted = States_sorted(automaton);
+	int *marks = calloc(len > 0 ? len : 1, sizeof(int));
+	if (marks == NULL) {
+		fprintf(stderr, "Error allocating memory for TuringMachine_accepts\n");
+		exit(EXIT_FAILURE);
+	}
+	int stamp = 0;
+	long steps = 0;
+	double start = Budget_clock();
+	
 	struct Automaton *current_states = Automaton_create();
 	struct MultiStackList *current_stacks = MultiStackList_create();
 	struct Automaton *next_states;
@@ -1899,9 +2380,12 @@ int TuringMachine_run(struct Automaton *automaton, char *input)
 	Stack_add(start_ms, start_stack);
 	MultiStack_add(current_stacks, start_ms);
 	
-	while(1) {
+	int accepted = 0;
+	int done = 0;
+	while (!done) {
 		if (flag_verbose) printf("---------------\n");
 		
+		stamp++;
 		next_states = Automaton_create();
 		next_stacks = MultiStackList_create();
 		
@@ -1913,14 +2397,15 @@ int TuringMachine_run(struct Automaton *automaton, char *input)
 				
 				int state_added = 0;
 				if (trans->symbol == '\0') {
-					State_add(next_states, trans->state);
+					State_add_marked(next_states, sorted, len, marks, stamp, trans->state);
 					if (mstmp != NULL) {
 						for (int k = 0; k < mstmp->len; k++) {
 							struct Stack *copy = Stack_copy(mstmp->stacks[k]);
 							if (trans->writesym != '\0')
-								copy->stack[copy->pos] = trans->writesym;
+								Stack_write(copy, trans->writesym);
 							int branch_reject = Stack_change_pos(copy, trans->direction);
 							if (!branch_reject) Stack_add_to(next_stacks, trans->state, copy);
+							else Stack_destroy(copy);
 						}
 					}
 				} else if (mstmp != NULL) {
@@ -1928,14 +2413,15 @@ int TuringMachine_run(struct Automaton *automaton, char *input)
 						struct Stack *stacktmp = mstmp->stacks[k];
 						if (trans->symbol == stacktmp->stack[stacktmp->pos]) {
 							if (!state_added) {
-								State_add(next_states, trans->state);
+								State_add_marked(next_states, sorted, len, marks, stamp, trans->state);
 								state_added = 1;
 							}
 							struct Stack *copy = Stack_copy(stacktmp);
 							if (trans->writesym != '\0')
-								copy->stack[copy->pos] = trans->writesym;
+								Stack_write(copy, trans->writesym);
 							int branch_reject = Stack_change_pos(copy, trans->direction);
 							if (!branch_reject) Stack_add_to(next_stacks, trans->state, copy);
+							else Stack_destroy(copy);
 						}
 					}
 				}
@@ -1963,14 +2449,15 @@ int TuringMachine_run(struct Automaton *automaton, char *input)
 				struct Transition *trans = state->trans[j];
 				if (trans->symbol == '\0') {
 					struct MultiStack *mstmp = MultiStack_get(next_stacks, state);
-					int added = State_add(next_states, trans->state);
+					int added = State_add_marked(next_states, sorted, len, marks, stamp, trans->state);
 					if (added && mstmp != NULL) {
 						for (int k = 0; k < mstmp->len; k++) {
 							struct Stack *copy = Stack_copy(mstmp->stacks[k]);
 							if (trans->writesym != '\0')
-								copy->stack[copy->pos] = trans->writesym;
+								Stack_write(copy, trans->writesym);
 							int branch_reject = Stack_change_pos(copy, trans->direction);
 							if (!branch_reject) Stack_add_to(next_stacks, trans->state, copy);
+							else Stack_destroy(copy);
 						}
 					}
 					
@@ -2007,32 +2494,46 @@ int TuringMachine_run(struct Automaton *automaton, char *input)
 		
 		// If no future states available, TM rejects
 		if (current_states->len == 0) {
-			printf("=>%s\n\tREJECTED\n", input);
-			MultiStackList_destroy(current_stacks);
-			Automaton_clear(current_states);
-			return 1;
+			done = 1;
+			break;
 		}
 		
-		// Only one nondeterministic branch need accept for NTM to accept
+		// Only one nondeterministic branch need accept for NTM to accept,
+		// and a branch that halted at a bounded end has no tape left
 		int reject_count = 0;
-		for (int i = 0; i < current_states->len; i++) {
-			if (current_states->states[i]->final) {
-				printf("=>%s\n\tACCEPTED\n", input);
-				MultiStackList_destroy(current_stacks);
-				Automaton_clear(current_states);
-				return 0;
+		for (int i = 0; i < current_states->len && !done; i++) {
+			struct State *state = current_states->states[i];
+			if (state->final && MultiStack_get(current_stacks, state) != NULL) {
+				accepted = 1;
+				done = 1;
 			} else if (current_states->states[i]->reject) {
 				reject_count++;
 			}
 		}
 		// All nondeterministic branches must reject for NTM to reject
-		if (reject_count == current_states->len) {
-			printf("=>%s\n\tREJECTED\n", input);
-			MultiStackList_destroy(current_stacks);
-			Automaton_clear(current_states);
-			return 1;
+		if (!done && reject_count == current_states->len)
+			done = 1;
+		
+		int max_tape = 0;
+		long configs = MultiStackList_count(current_stacks, &max_tape);
+		if (!done && Budget_over(++steps, configs, max_tape, start)) {
+			accepted = VERDICT_LIMIT;
+			done = 1;
 		}
 	}
+	
+	MultiStackList_destroy(current_stacks);
+	Automaton_clear(current_states);
+	free(sorted);
+	free(marks);
+	return accepted;
+}
+
+int TuringMachine_run(struct Automaton *automaton, char *input)
+{
+	int accepted = TuringMachine_accepts(automaton, input);
+	Sink_result(&result_sink, input, strlen(input), accepted);
+	return accepted != 1;
 }
 
 void Automaton_run_file(struct Automaton *automaton, char *input_string_file)
@@ -2049,6 +2550,11 @@ void Automaton_run_file(struct Automaton *automaton, char *input_string_file)
 	}
 	
 	int machine_code = isDFA(automaton);
+	if (machine_code == 1 && !flag_verbose && !execute && !delay) {
+		fclose(input_string_fp);
+		Automaton_run_stream(automaton, input_string_file, 0);
+		return;
+	}
 	while ((read = getline(&input_string, &len, input_string_fp)) != -1)
 	{
 		input_string[strcspn(input_string, "\r\n")] = 0;
@@ -2060,4 +2566,216 @@ void Automaton_run_file(struct Automaton *automaton, char *input_string_file)
 			TuringMachine_run(automaton, input_string);
 		}
 	}
+	free(input_string);
+	fclose(input_string_fp);
+}
+
+// NUL-terminated copy of a record in *line, for runners that need one
+static void Record_line(char *record, size_t len, char **line, size_t *line_max)
+{
+	if (len + 1 > *line_max) {
+		*line_max = len + 1;
+		*line = realloc(*line, sizeof(char) * *line_max);
+		if (*line == NULL) {
+			fprintf(stderr, "Error allocating memory for input record\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(*line, record, len);
+	(*line)[len] = '\0';
+}
+
+// The state a DFA ends in after one record, or NULL if it dies first.
+// Untraced runs use the compiled table on the bytes in place
+static struct State *Record_end(struct Automaton *automaton, char *record, size_t len,
+	char **line, size_t *line_max)
+{
+	if (!flag_verbose && !execute && !delay) {
+		struct DFATable *table = automaton->table;
+		int state = DFATable_step(table, table->start, record, len);
+		return state >= 0 ? table->states[state] : NULL;
+	}
+	Record_line(record, len, line, line_max);
+	return DFA_end(automaton, *line);
+}
+
+// Verdict for one record without printing it. Compiled DFAs run on the
+// bytes in place; the other runners get a NUL-terminated copy in *line
+int Record_accepts(struct Automaton *automaton, int machine_code,
+	char *record, size_t len, char **line, size_t *line_max)
+{
+	if (machine_code == 1) {
+		struct State *state = Record_end(automaton, record, len, line, line_max);
+		return state != NULL && state->final;
+	}
+	if (machine_code == 0 && (automaton->table != NULL || automaton->nfa != NULL) &&
+			!flag_verbose && !execute && !delay)
+		return NFA_accepts(automaton, record, len);
+	if (machine_code == 2 && automaton->pda != NULL && !flag_verbose && !execute && !delay)
+		return PDATable_accepts(automaton->pda, record, len);
+	if (machine_code == 2 && automaton->chart != NULL && !flag_verbose && !execute && !delay)
+		return PDAChart_accepts(automaton->chart, record, len);
+	
+	Record_line(record, len, line, line_max);
+	if (machine_code != 3)
+		return Automaton_accepts(automaton, *line);
+	else
+		return TuringMachine_accepts(automaton, *line);
+}
+
+static void Automaton_run_record(struct Automaton *automaton, int machine_code,
+	char *record, size_t len, char **line, size_t *line_max)
+{
+	if (len > 0 && record[len-1] == '\r') len--;
+	if (machine_code == 1) {
+		Sink_state(&result_sink, record, len, Record_end(automaton, record, len, line, line_max));
+		return;
+	}
+	int accepted = Record_accepts(automaton, machine_code, record, len, line, line_max);
+	Sink_result(&result_sink, record, len, accepted);
+}
+
+// A whole input is one huge record, which untraced DFAs split across threads
+static void Automaton_run_whole(struct Automaton *automaton, int machine_code,
+	char *input, size_t len, char **line, size_t *line_max)
+{
+	if (automaton->search != NULL) {
+		Search_record(automaton->search, input, len);
+	} else if (machine_code == 1 && num_threads > 1 && !flag_verbose && !execute && !delay) {
+		struct DFATable *table = automaton->table;
+		int state = DFATable_run_parallel(table, input, len, num_threads);
+		Sink_state(&result_sink, input, len, state >= 0 ? table->states[state] : NULL);
+	} else if (machine_code == 1) {
+		Sink_state(&result_sink, input, len, Record_end(automaton, input, len, line, line_max));
+	} else {
+		int accepted = Record_accepts(automaton, machine_code, input, len, line, line_max);
+		Sink_result(&result_sink, input, len, accepted);
+	}
+}
+
+// Print the results of a group of DFA records and empty it
+static void Automaton_run_group(struct Automaton *automaton, struct DFAGroup *group)
+{
+	struct DFATable *table = automaton->table;
+	DFATable_run_many(table, group);
+	for (int i = 0; i < group->len; i++) {
+		int state = group->states[i];
+		Sink_state(&result_sink, group->inputs[i], group->lens[i],
+			state >= 0 ? table->states[state] : NULL);
+	}
+	group->len = 0;
+}
+
+// Run every newline-terminated record in buf. Returns the number of bytes
+// consumed; a trailing partial record is only run once eof is reached.
+// Untraced DFAs run records in groups so they can be interleaved.
+static size_t Automaton_run_records(struct Automaton *automaton, int machine_code,
+	char *buf, size_t len, int eof, char **line, size_t *line_max)
+{
+	if (automaton->search != NULL)
+		return Search_records(automaton->search, buf, len, eof);
+	
+	struct DFAGroup group;
+	group.len = 0;
+	int grouped = machine_code == 1 && !flag_verbose && !execute && !delay;
+	
+	size_t pos = 0;
+	while (pos < len) {
+		char *nl = memchr(buf + pos, '\n', len - pos);
+		if (nl == NULL && !eof) break;
+		size_t rec_end = nl ? (size_t)(nl - buf) : len;
+		if (grouped) {
+			size_t rec_len = rec_end - pos;
+			if (rec_len > 0 && buf[rec_end-1] == '\r') rec_len--;
+			group.inputs[group.len] = buf + pos;
+			group.lens[group.len] = rec_len;
+			if (++group.len == DFA_GROUP) Automaton_run_group(automaton, &group);
+		} else {
+			Automaton_run_record(automaton, machine_code, buf + pos, rec_end - pos, line, line_max);
+		}
+		pos = nl ? rec_end + 1 : len;
+	}
+	if (group.len > 0) Automaton_run_group(automaton, &group);
+	return pos;
+}
+
+// Like Automaton_run_file, but scans the input in place: regular files are
+// mmapped, pipes ("-" is stdin) are read in STREAM_BUFFER sized blocks.
+// With whole set the entire input is run as a single raw record.
+void Automaton_run_stream(struct Automaton *automaton, char *input_file, int whole)
+{
+	int fd = STDIN_FILENO;
+	if (strcmp(input_file, "-") != 0) {
+		fd = open(input_file, O_RDONLY);
+		if (fd == -1) {
+			fprintf(stderr, "Error opening %s\n", input_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	int machine_code = isDFA(automaton);
+	if (machine_code == 1 && automaton->table == NULL)
+		automaton->table = DFATable_create(automaton);
+	if ((machine_code == 0 || machine_code == 2) && automaton->search == NULL)
+		NFA_prepare(automaton);
+	
+	char *line = NULL;
+	size_t line_max = 0;
+	
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			if (whole)
+				Automaton_run_whole(automaton, machine_code, map, st.st_size, &line, &line_max);
+			else
+				Automaton_run_records(automaton, machine_code, map, st.st_size, 1, &line, &line_max);
+			munmap(map, st.st_size);
+			free(line);
+			if (fd != STDIN_FILENO) close(fd);
+			return;
+		}
+	}
+	
+	// Not mappable: keep records contiguous by moving a partial record to the
+	// front of the buffer before the next read, growing it for long records
+	size_t max_len = STREAM_BUFFER;
+	size_t len = 0;
+	char *buf = malloc(sizeof(char) * max_len);
+	if (buf == NULL) {
+		fprintf(stderr, "Error allocating memory for input stream buffer\n");
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		if (len == max_len) {
+			max_len *= 2;
+			buf = realloc(buf, sizeof(char) * max_len);
+			if (buf == NULL) {
+				fprintf(stderr, "Error reallocating memory for input stream buffer\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		ssize_t n = read(fd, buf + len, max_len - len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error reading %s\n\t%s\n", input_file, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		len += n;
+		if (whole) {
+			if (n == 0) {
+				Automaton_run_whole(automaton, machine_code, buf, len, &line, &line_max);
+				break;
+			}
+			continue;
+		}
+		size_t used = Automaton_run_records(automaton, machine_code, buf, len, n == 0, &line, &line_max);
+		if (n == 0) break;
+		memmove(buf, buf + used, len - used);
+		len -= used;
+	}
+	free(buf);
+	free(line);
+	if (fd != STDIN_FILENO) close(fd);
 }
@@ -2,13 +2,35 @@
 #define AUTO_H_
 
 #define STATE_NAME_MAX 100
+#define STREAM_BUFFER (1 << 20)
+
+// Verdict of a run that went over its budget, besides 1 and 0
+#define VERDICT_LIMIT -1
+
+// Ways to explore the branches of a nondeterministic TM (-t)
+#define EXPLORE_BFS 0      // every branch one step at a time (default)
+#define EXPLORE_DFS 1      // one branch at a time, keeping only its path
+#define EXPLORE_IDDFS 2    // depth first to a limit that doubles each round
+
+// Limits on one run of the PDA or TM engines, 0 for none (-B)
+struct Budget {
+	long steps;        // machine steps, or moves when exploring depth first
+	long configs;      // live configurations
+	long length;       // symbols on one stack or tape
+	double seconds;    // wall time
+};
 
 extern int flag_verbose;
+extern int flag_chart;
+extern int num_threads;
+extern long lazy_budget;
 extern double delay;
 extern int execute;
 extern char tm_blank;
 extern char tm_bound;
 extern int tm_bound_halt;
+extern int tm_explore;
+extern struct Budget budget;
 
 struct Automaton {
 	int max_len;
@@ -16,6 +38,13 @@ struct Automaton {
 	struct State *start;
 	//struct Alphabet *alphabet;
 	struct State **states;
+	struct DFATable *table;
+	struct NFATable *nfa;
+	struct LazyDFA *lazy;
+	struct Search *search;
+	struct PDATable *pda;
+	struct PDAChart *chart;
+	int prepared;            // NFA_prepare has picked the tables above
 };
 
 struct Transition {
@@ -29,17 +58,22 @@ struct Transition {
 
 struct State {
 	char *name;
+	int id;
 	char *cmd;
 	char **cmd_args;
 	int start;
 	int final;
 	int reject;
+	int *tags;               // sorted ids of the patterns accepted here
+	int num_tags;
 	struct Transition **trans;
 	int num_trans;
 	int max_trans;
 };
 
 struct State *State_create(char *name);
+void State_tag(struct State *state, int tag);
+int State_tags_equal(struct State *s0, struct State *s1);
 struct Automaton *Automaton_create();
 struct State* State_get(struct Automaton *automaton, char *name);
 void State_name_add(struct Automaton *automaton, char *name);
@@ -55,10 +89,22 @@ int isnamechar(char c);
 static int State_compare(const void *a, const void *b);
 struct Automaton *Automaton_import(char *filename);
 int isDFA(struct Automaton *automaton);
+int isPartialDFA(struct Automaton *automaton);
+int isDPDA(struct Automaton *automaton);
+void NFA_prepare(struct Automaton *automaton);
+void Automaton_compile(struct Automaton *automaton);
+struct State *DFA_end(struct Automaton *automaton, char *input);
+int DFA_accepts(struct Automaton *automaton, char *input);
 int DFA_run(struct Automaton *automaton, char *input);
 //int Machine_advance(struct MultiStackList *source, struct MultiStackList *target, struct Automaton *automaton, struct State *state, struct Transition *trans);
+int Automaton_accepts(struct Automaton *automaton, char *input);
 int Automaton_run(struct Automaton *automaton, char *input);
+int TuringMachine_accepts(struct Automaton *automaton, char *input);
 int TuringMachine_run(struct Automaton *automaton, char *input);
 void Automaton_run_file(struct Automaton *automaton, char *input_string_file);
+int Record_accepts(struct Automaton *automaton, int machine_code,
+	char *record, size_t len, char **line, size_t *line_max);
+void Automaton_run_stream(struct Automaton *automaton, char *input_file, int whole);
+int Budget_parse(char *spec);
 
 #endif // AUTO_H_
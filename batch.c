@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "auto.h"
+#include "dfa.h"
+#include "nfa.h"
+#include "sink.h"
+#include "batch.h"
+
+static void Batch_run_group(struct Batch *batch, struct BatchChunk *chunk, struct DFAGroup *group)
+{
+	struct DFATable *table = batch->automaton->table;
+	DFATable_run_many(table, group);
+	for (int i = 0; i < group->len; i++) {
+		int state = group->states[i];
+		Sink_state(&chunk->sink, group->inputs[i], group->lens[i],
+			state >= 0 ? table->states[state] : NULL);
+	}
+	group->len = 0;
+}
+
+// Chunk c owns every record that starts inside its byte range
+static void Batch_run_chunk(struct Batch *batch, struct Automaton *automaton, long c,
+	struct BatchChunk *chunk, char **line, size_t *line_max)
+{
+	char *buf = batch->buf;
+	size_t size = batch->size;
+	size_t pos = c * batch->chunk_size;
+	size_t end = pos + batch->chunk_size;
+	if (end > size) end = size;
+
+	if (pos > 0 && buf[pos-1] != '\n') {
+		char *nl = memchr(buf + pos, '\n', size - pos);
+		pos = nl ? (size_t)(nl - buf) + 1 : size;
+	}
+	struct DFAGroup group;
+	group.len = 0;
+	while (pos < end) {
+		char *nl = memchr(buf + pos, '\n', size - pos);
+		size_t rec_end = nl ? (size_t)(nl - buf) : size;
+		size_t len = rec_end - pos;
+		if (len > 0 && buf[rec_end-1] == '\r') len--;
+
+		if (batch->machine_code == 1) {
+			group.inputs[group.len] = buf + pos;
+			group.lens[group.len] = len;
+			if (++group.len == DFA_GROUP) Batch_run_group(batch, chunk, &group);
+		} else {
+			int accepted = Record_accepts(automaton, batch->machine_code, buf + pos, len, line, line_max);
+			Sink_result(&chunk->sink, buf + pos, len, accepted);
+		}
+
+		pos = rec_end + 1;
+	}
+	if (group.len > 0) Batch_run_group(batch, chunk, &group);
+}
+
+static void *Batch_worker(void *arg)
+{
+	struct Batch *batch = arg;
+	char *line = NULL;
+	size_t line_max = 0;
+	// A lazy DFA fills itself in as it runs, so each worker keeps its own
+	struct Automaton automaton = *batch->automaton;
+	automaton.lazy = NULL;
+
+	while (1) {
+		pthread_mutex_lock(&batch->lock);
+		// Stay at most window chunks ahead of the printer
+		while (batch->next_claim < batch->num_chunks &&
+				batch->next_claim >= batch->next_print + batch->window)
+			pthread_cond_wait(&batch->cond, &batch->lock);
+		if (batch->next_claim >= batch->num_chunks) {
+			pthread_mutex_unlock(&batch->lock);
+			break;
+		}
+		long c = batch->next_claim++;
+		pthread_mutex_unlock(&batch->lock);
+
+		struct BatchChunk *chunk = &batch->chunks[c % batch->window];
+		Batch_run_chunk(batch, &automaton, c, chunk, &line, &line_max);
+
+		pthread_mutex_lock(&batch->lock);
+		chunk->done = 1;
+		pthread_cond_broadcast(&batch->cond);
+		pthread_mutex_unlock(&batch->lock);
+	}
+	free(line);
+	if (automaton.lazy != NULL) LazyDFA_destroy(automaton.lazy);
+	return NULL;
+}
+
+// Run every line of input_file on a pool of worker threads. Results are
+// printed in input order. Inputs that cannot be mmapped, and traced runs,
+// fall back to the single-threaded stream runner.
+void Automaton_run_batch(struct Automaton *automaton, char *input_file, int threads)
+{
+	if (threads < 2 || flag_verbose || execute || delay) {
+		Automaton_run_stream(automaton, input_file, 0);
+		return;
+	}
+
+	int fd = -1;
+	if (strcmp(input_file, "-") != 0) fd = open(input_file, O_RDONLY);
+	struct stat st;
+	char *map = MAP_FAILED;
+	if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		if (fd != -1) close(fd);
+		Automaton_run_stream(automaton, input_file, 0);
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	struct Batch batch;
+	batch.automaton = automaton;
+	batch.machine_code = isDFA(automaton);
+	if (batch.machine_code == 1 && automaton->table == NULL)
+		automaton->table = DFATable_create(automaton);
+	// The engine is picked once here, before the workers share the machine
+	if (batch.machine_code == 0 || batch.machine_code == 2)
+		NFA_prepare(automaton);
+	batch.buf = map;
+	batch.size = st.st_size;
+
+	// Small files still get enough chunks to keep every thread busy
+	batch.chunk_size = batch.size / (threads * 16);
+	if (batch.chunk_size > BATCH_CHUNK) batch.chunk_size = BATCH_CHUNK;
+	if (batch.chunk_size < 4096) batch.chunk_size = 4096;
+	batch.num_chunks = (batch.size + batch.chunk_size - 1) / batch.chunk_size;
+	batch.next_claim = 0;
+	batch.next_print = 0;
+	batch.window = threads * 4;
+	batch.chunks = malloc(sizeof(struct BatchChunk) * batch.window);
+	if (batch.chunks == NULL) {
+		fprintf(stderr, "Error allocating memory for BatchChunk array\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < batch.window; i++) {
+		batch.chunks[i].done = 0;
+		Sink_init(&batch.chunks[i].sink, result_sink.mode, NULL);
+	}
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+	if (workers == NULL) {
+		fprintf(stderr, "Error allocating memory for worker threads\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i], NULL, Batch_worker, &batch) != 0) {
+			fprintf(stderr, "Error creating worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (long c = 0; c < batch.num_chunks; c++) {
+		struct BatchChunk *chunk = &batch.chunks[c % batch.window];
+		pthread_mutex_lock(&batch.lock);
+		while (!chunk->done) pthread_cond_wait(&batch.cond, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+
+		Sink_append(&result_sink, &chunk->sink);
+
+		pthread_mutex_lock(&batch.lock);
+		chunk->done = 0;
+		batch.next_print++;
+		pthread_cond_broadcast(&batch.cond);
+		pthread_mutex_unlock(&batch.lock);
+	}
+
+	for (int i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+	free(workers);
+	for (int i = 0; i < batch.window; i++) Sink_destroy(&batch.chunks[i].sink);
+	free(batch.chunks);
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.cond);
+	munmap(map, st.st_size);
+	close(fd);
+}
+
+// Run a segment from every entry state at once. Lanes whose states meet
+// are merged, since they follow the same path from then on, so the cost
+// quickly drops to that of a single run for most DFAs.
+static void *DFASegment_run(void *arg)
+{
+	struct DFASegment *seg = arg;
+	struct DFATable *table = seg->table;
+	const int *next = table->next;
+	const unsigned char *classmap = table->classmap;
+	const int nclasses = table->nclasses;
+	const unsigned char *s = (const unsigned char *)seg->input;
+	
+	int n = seg->num_entry;
+	int *lane = malloc(sizeof(int) * n);
+	int *state = malloc(sizeof(int) * n);
+	int *merged = malloc(sizeof(int) * n);
+	int *where = malloc(sizeof(int) * (table->len + 1));
+	if (lane == NULL || state == NULL || merged == NULL || where == NULL) {
+		fprintf(stderr, "Error allocating memory for DFASegment lanes\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i <= table->len; i++) where[i] = -1;
+	for (int i = 0; i < n; i++) {
+		lane[i] = i;
+		state[i] = seg->entry[i];
+	}
+	int num_lanes = n;
+	
+	size_t pos = 0;
+	while (pos < seg->len) {
+		size_t stop = pos + 256;
+		if (stop > seg->len) stop = seg->len;
+		for (; pos < stop; pos++) {
+			int c = classmap[s[pos]];
+			for (int l = 0; l < num_lanes; l++)
+				if (state[l] >= 0) state[l] = next[state[l] * nclasses + c];
+		}
+		if (num_lanes == 1) {
+			if (state[0] < 0) break;
+			continue;
+		}
+		
+		// where[] is indexed by state + 1 so the dead state -1 merges too
+		int num_merged = 0;
+		for (int l = 0; l < num_lanes; l++) {
+			int key = state[l] + 1;
+			if (where[key] < 0) {
+				where[key] = num_merged;
+				state[num_merged++] = state[l];
+			}
+			merged[l] = where[key];
+		}
+		for (int l = 0; l < num_merged; l++) where[state[l] + 1] = -1;
+		if (num_merged < num_lanes) {
+			for (int i = 0; i < n; i++) lane[i] = merged[lane[i]];
+			num_lanes = num_merged;
+		}
+	}
+	
+	for (int i = 0; i < n; i++) seg->exit[i] = state[lane[i]];
+	free(lane);
+	free(state);
+	free(merged);
+	free(where);
+	return NULL;
+}
+
+// Run one huge input on several threads. The first segment runs from the
+// start state; every other segment runs from all states when the DFA is
+// small, or else from the state the DFA_LOOKBACK bytes before it lead to.
+// Composing the segments in order gives the exact final state, and any
+// segment entered in a state it did not cover is rerun from that state.
+int DFATable_run_parallel(struct DFATable *table, char *input, size_t len, int threads)
+{
+	if (threads < 2 || len < DFA_PARALLEL_MIN || table->start < 0)
+		return DFATable_step(table, table->start, input, len);
+	
+	size_t seg_len = len / threads;
+	struct DFASegment *segs = malloc(sizeof(struct DFASegment) * threads);
+	pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+	if (segs == NULL || workers == NULL) {
+		fprintf(stderr, "Error allocating memory for DFASegment array\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	for (int t = 0; t < threads; t++) {
+		struct DFASegment *seg = &segs[t];
+		seg->table = table;
+		seg->input = input + t * seg_len;
+		seg->len = (t == threads - 1) ? len - t * seg_len : seg_len;
+		if (t == 0) {
+			seg->num_entry = 1;
+		} else if (table->len <= DFA_SPECULATE) {
+			seg->num_entry = table->len;
+		} else {
+			seg->num_entry = 1;
+		}
+		seg->entry = malloc(sizeof(int) * seg->num_entry);
+		seg->exit = malloc(sizeof(int) * seg->num_entry);
+		if (seg->entry == NULL || seg->exit == NULL) {
+			fprintf(stderr, "Error allocating memory for DFASegment states\n");
+			exit(EXIT_FAILURE);
+		}
+		if (t == 0) {
+			seg->entry[0] = table->start;
+		} else if (table->len <= DFA_SPECULATE) {
+			for (int i = 0; i < table->len; i++) seg->entry[i] = i;
+		} else {
+			size_t back = t * seg_len < DFA_LOOKBACK ? t * seg_len : DFA_LOOKBACK;
+			seg->entry[0] = DFATable_step(table, table->start, seg->input - back, back);
+		}
+		if (pthread_create(&workers[t], NULL, DFASegment_run, seg) != 0) {
+			fprintf(stderr, "Error creating worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+	
+	int state = segs[0].exit[0];
+	for (int t = 1; t < threads && state >= 0; t++) {
+		struct DFASegment *seg = &segs[t];
+		int found = 0;
+		for (int i = 0; i < seg->num_entry; i++) {
+			if (seg->entry[i] == state) {
+				state = seg->exit[i];
+				found = 1;
+				break;
+			}
+		}
+		if (!found) state = DFATable_step(table, state, seg->input, seg->len);
+	}
+	
+	for (int t = 0; t < threads; t++) {
+		free(segs[t].entry);
+		free(segs[t].exit);
+	}
+	free(segs);
+	free(workers);
+	return state;
+}
@@ -0,0 +1,46 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <pthread.h>
+
+#define BATCH_CHUNK (1 << 18)
+#define DFA_PARALLEL_MIN (1 << 20)
+#define DFA_SPECULATE 256
+#define DFA_LOOKBACK 4096
+
+// Output of one chunk of input records, written by a worker and
+// printed by the main thread once every earlier chunk is printed
+struct BatchChunk {
+	int done;
+	struct Sink sink;
+};
+
+struct Batch {
+	struct Automaton *automaton;
+	int machine_code;
+	char *buf;
+	size_t size;
+	size_t chunk_size;
+	long num_chunks;
+	long next_claim;
+	long next_print;
+	int window;
+	struct BatchChunk *chunks;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// One segment of a parallel DFA run: the state reached at the end of the
+// segment (exit) for each candidate state it may be entered in (entry)
+struct DFASegment {
+	struct DFATable *table;
+	char *input;
+	size_t len;
+	int num_entry;
+	int *entry;
+	int *exit;
+};
+
+int DFATable_run_parallel(struct DFATable *table, char *input, size_t len, int threads);
+void Automaton_run_batch(struct Automaton *automaton, char *input_file, int threads);
+#endif // BATCH_H_
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auto.h"
+#include "chart.h"
+
+// Build the chart form of a PDA
+struct PDAChart *PDAChart_create(struct Automaton *automaton)
+{
+	struct PDAChart *chart = malloc(sizeof(struct PDAChart));
+	if (chart == NULL) {
+		fprintf(stderr, "Error allocating memory for PDAChart\n");
+		exit(EXIT_FAILURE);
+	}
+	int len = automaton->len;
+	int num_moves = 0;
+	for (int i = 0; i < len; i++) num_moves += automaton->states[i]->num_trans;
+	chart->len = len;
+	chart->start = -1;
+	chart->final = malloc(sizeof(char) * (len > 0 ? len : 1));
+	chart->first = malloc(sizeof(int) * (len + 1));
+	chart->moves = malloc(sizeof(struct ChartMove) * (num_moves > 0 ? num_moves : 1));
+	int *ids = malloc(sizeof(int) * (len > 0 ? len : 1));
+	if (chart->final == NULL || chart->first == NULL || chart->moves == NULL || ids == NULL) {
+		fprintf(stderr, "Error allocating memory for moves in PDAChart\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len; i++) {
+		ids[i] = automaton->states[i]->id;
+		automaton->states[i]->id = i;
+	}
+
+	int k = 0;
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		chart->final[i] = state->final ? 1 : 0;
+		if (state == automaton->start) chart->start = i;
+		chart->first[i] = k;
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			chart->moves[k].target = trans->state->id;
+			chart->moves[k].symbol = trans->symbol;
+			chart->moves[k].pop = trans->readsym;
+			chart->moves[k].push = trans->writesym;
+			k++;
+		}
+	}
+	chart->first[len] = k;
+
+	for (int i = 0; i < len; i++) automaton->states[i]->id = ids[i];
+	free(ids);
+	return chart;
+}
+
+void PDAChart_destroy(struct PDAChart *chart)
+{
+	free(chart->final);
+	free(chart->first);
+	free(chart->moves);
+	free(chart);
+}
+
+// A state and input position where the machine has just pushed a symbol.
+// Everything it does from there until that symbol is popped again leaves
+// the stack below alone, so it is worked out once for all the pushes that
+// lead there. waiters lists those pushes, and items chains this origin's
+// items at its own position.
+struct ChartOrigin {
+	int state;
+	size_t pos;
+	int waiters;
+	int items;
+};
+
+// A push into origin, made from the items of level: once symbol is popped
+// the machine is back in level, with the stack it had there
+struct ChartWaiter {
+	int origin;
+	int level;
+	char symbol;
+	int next;
+};
+
+// The machine can be in state at the position of the set holding this,
+// on top of the stack it had when origin was reached
+struct ChartItem {
+	int origin;
+	int state;
+	int chain;
+};
+
+// The items at one input position, with an open addressing index
+struct ChartSet {
+	int len;
+	int max_len;
+	struct ChartItem *items;
+	int num_slots;
+	int *slots;
+};
+
+// Working memory of one run
+struct ChartRun {
+	struct PDAChart *chart;
+	char *input;
+	size_t len;
+	size_t pos;
+	int num_origins;
+	int max_origins;
+	struct ChartOrigin *origins;
+	int *origin_at[2];      // origin of each state at even and odd positions
+	int num_waiters;
+	int max_waiters;
+	struct ChartWaiter *waiters;
+	int num_waiter_slots;
+	int *waiter_slots;
+	struct ChartSet *sets[2]; // the current position and the next
+	int num_redo;
+	int max_redo;
+	int *redo;              // current items to run again for a new waiter
+};
+
+static unsigned Chart_hash(int a, int b, int c)
+{
+	unsigned long long hash = (unsigned long long)(unsigned)a * 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (unsigned)b) * 0xC2B2AE3D27D4EB4FULL;
+	hash = (hash ^ (unsigned)c) * 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(hash >> 32);
+}
+
+static void *Chart_grow(void *array, int *max_len, size_t size)
+{
+	*max_len *= 2;
+	array = realloc(array, size * *max_len);
+	if (array == NULL) {
+		fprintf(stderr, "Error reallocating memory for PDA chart\n");
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
+
+static int *Chart_slots(int num_slots)
+{
+	int *slots = malloc(sizeof(int) * num_slots);
+	if (slots == NULL) {
+		fprintf(stderr, "Error allocating memory for PDA chart\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(slots, -1, sizeof(int) * num_slots);
+	return slots;
+}
+
+static struct ChartSet *ChartSet_create()
+{
+	struct ChartSet *set = malloc(sizeof(struct ChartSet));
+	if (set == NULL) {
+		fprintf(stderr, "Error allocating memory for PDA chart\n");
+		exit(EXIT_FAILURE);
+	}
+	set->len = 0;
+	set->max_len = 16;
+	set->items = malloc(sizeof(struct ChartItem) * set->max_len);
+	if (set->items == NULL) {
+		fprintf(stderr, "Error allocating memory for PDA chart\n");
+		exit(EXIT_FAILURE);
+	}
+	set->num_slots = 32;
+	set->slots = Chart_slots(set->num_slots);
+	return set;
+}
+
+static void ChartSet_destroy(struct ChartSet *set)
+{
+	free(set->items);
+	free(set->slots);
+	free(set);
+}
+
+static int ChartSet_slot(struct ChartSet *set, int origin, int state)
+{
+	int mask = set->num_slots - 1;
+	int i = Chart_hash(origin, state, 0) & mask;
+	while (set->slots[i] != -1) {
+		struct ChartItem *item = &set->items[set->slots[i]];
+		if (item->origin == origin && item->state == state) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// Add an item unless the set already has it. Returns its index if added,
+// or -1
+static int ChartSet_add(struct ChartSet *set, int origin, int state)
+{
+	if ((set->len + 1) * 2 > set->num_slots) {
+		free(set->slots);
+		set->num_slots *= 2;
+		set->slots = Chart_slots(set->num_slots);
+		for (int i = 0; i < set->len; i++)
+			set->slots[ChartSet_slot(set, set->items[i].origin, set->items[i].state)] = i;
+	}
+	int slot = ChartSet_slot(set, origin, state);
+	if (set->slots[slot] != -1) return -1;
+	if (set->len == set->max_len)
+		set->items = Chart_grow(set->items, &set->max_len, sizeof(struct ChartItem));
+	set->items[set->len].origin = origin;
+	set->items[set->len].state = state;
+	set->items[set->len].chain = -1;
+	set->slots[slot] = set->len;
+	return set->len++;
+}
+
+static void ChartSet_clear(struct ChartSet *set)
+{
+	if (set->len * 8 < set->num_slots) {
+		free(set->slots);
+		set->num_slots = 32;
+		set->slots = Chart_slots(set->num_slots);
+	} else {
+		memset(set->slots, -1, sizeof(int) * set->num_slots);
+	}
+	set->len = 0;
+}
+
+// The origin for state at pos, made if there is none yet
+static int ChartRun_origin(struct ChartRun *run, int state, size_t pos)
+{
+	int *at = run->origin_at[pos & 1];
+	if (at[state] >= 0 && run->origins[at[state]].pos == pos) return at[state];
+	if (run->num_origins == run->max_origins)
+		run->origins = Chart_grow(run->origins, &run->max_origins, sizeof(struct ChartOrigin));
+	struct ChartOrigin *origin = &run->origins[run->num_origins];
+	origin->state = state;
+	origin->pos = pos;
+	origin->waiters = -1;
+	origin->items = -1;
+	at[state] = run->num_origins;
+	return run->num_origins++;
+}
+
+static int ChartRun_waiter_slot(struct ChartRun *run, int origin, int level, char symbol)
+{
+	int mask = run->num_waiter_slots - 1;
+	int i = Chart_hash(origin, level, (unsigned char)symbol) & mask;
+	while (run->waiter_slots[i] != -1) {
+		struct ChartWaiter *waiter = &run->waiters[run->waiter_slots[i]];
+		if (waiter->origin == origin && waiter->level == level && waiter->symbol == symbol) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// Record a push of symbol into origin from level. Returns 1 if it is new
+static int ChartRun_wait(struct ChartRun *run, int origin, int level, char symbol)
+{
+	if ((run->num_waiters + 1) * 2 > run->num_waiter_slots) {
+		free(run->waiter_slots);
+		run->num_waiter_slots *= 2;
+		run->waiter_slots = Chart_slots(run->num_waiter_slots);
+		for (int i = 0; i < run->num_waiters; i++) {
+			struct ChartWaiter *waiter = &run->waiters[i];
+			run->waiter_slots[ChartRun_waiter_slot(run, waiter->origin, waiter->level, waiter->symbol)] = i;
+		}
+	}
+	int slot = ChartRun_waiter_slot(run, origin, level, symbol);
+	if (run->waiter_slots[slot] != -1) return 0;
+	if (run->num_waiters == run->max_waiters)
+		run->waiters = Chart_grow(run->waiters, &run->max_waiters, sizeof(struct ChartWaiter));
+	struct ChartWaiter *waiter = &run->waiters[run->num_waiters];
+	waiter->origin = origin;
+	waiter->level = level;
+	waiter->symbol = symbol;
+	waiter->next = run->origins[origin].waiters;
+	run->origins[origin].waiters = run->num_waiters;
+	run->waiter_slots[slot] = run->num_waiters++;
+	return 1;
+}
+
+// Add the item for state at pos on top of the stack of origin
+static void ChartRun_add(struct ChartRun *run, int origin, int state, size_t pos)
+{
+	struct ChartSet *set = run->sets[pos != run->pos];
+	int item = ChartSet_add(set, origin, state);
+	if (item >= 0 && run->origins[origin].pos == pos) {
+		set->items[item].chain = run->origins[origin].items;
+		run->origins[origin].items = item;
+	}
+}
+
+// The machine reaches state at pos in level, then pushes push if it is
+// not '\0'
+static void ChartRun_land(struct ChartRun *run, int level, int state, size_t pos, char push)
+{
+	if (push == '\0') {
+		ChartRun_add(run, level, state, pos);
+		return;
+	}
+	int origin = ChartRun_origin(run, state, pos);
+	// Items already run at the current position missed this push
+	if (ChartRun_wait(run, origin, level, push) && pos == run->pos) {
+		for (int i = run->origins[origin].items; i >= 0; i = run->sets[0]->items[i].chain) {
+			if (run->num_redo == run->max_redo)
+				run->redo = Chart_grow(run->redo, &run->max_redo, sizeof(int));
+			run->redo[run->num_redo++] = i;
+		}
+	}
+	ChartRun_add(run, origin, state, pos);
+}
+
+// Take every move from a current item
+static void ChartRun_item(struct ChartRun *run, int item)
+{
+	struct PDAChart *chart = run->chart;
+	int origin = run->sets[0]->items[item].origin;
+	int state = run->sets[0]->items[item].state;
+	for (int k = chart->first[state]; k < chart->first[state+1]; k++) {
+		struct ChartMove *move = &chart->moves[k];
+		size_t pos = run->pos;
+		if (move->symbol != '\0') {
+			if (pos >= run->len || run->input[pos] != move->symbol) continue;
+			pos++;
+		}
+		if (move->pop == '\0') {
+			ChartRun_land(run, origin, move->target, pos, move->push);
+			continue;
+		}
+		// Popping returns to each level that pushed the symbol
+		for (int w = run->origins[origin].waiters; w >= 0; w = run->waiters[w].next) {
+			if (run->waiters[w].symbol == move->pop)
+				ChartRun_land(run, run->waiters[w].level, move->target, pos, move->push);
+		}
+	}
+}
+
+// Run input through the chart. Each position's items are complete once
+// every item and every item run again for a late push has been taken
+int PDAChart_accepts(struct PDAChart *chart, char *input, size_t len)
+{
+	if (chart->start < 0) return 0;
+	struct ChartRun run;
+	run.chart = chart;
+	run.input = input;
+	run.len = len;
+	run.pos = 0;
+	run.num_origins = 0;
+	run.max_origins = 16;
+	run.origins = malloc(sizeof(struct ChartOrigin) * run.max_origins);
+	run.origin_at[0] = malloc(sizeof(int) * (chart->len > 0 ? chart->len : 1));
+	run.origin_at[1] = malloc(sizeof(int) * (chart->len > 0 ? chart->len : 1));
+	run.num_waiters = 0;
+	run.max_waiters = 16;
+	run.waiters = malloc(sizeof(struct ChartWaiter) * run.max_waiters);
+	run.num_redo = 0;
+	run.max_redo = 16;
+	run.redo = malloc(sizeof(int) * run.max_redo);
+	if (run.origins == NULL || run.origin_at[0] == NULL || run.origin_at[1] == NULL ||
+			run.waiters == NULL || run.redo == NULL) {
+		fprintf(stderr, "Error allocating memory for PDA chart\n");
+		exit(EXIT_FAILURE);
+	}
+	run.num_waiter_slots = 32;
+	run.waiter_slots = Chart_slots(run.num_waiter_slots);
+	memset(run.origin_at[0], -1, sizeof(int) * (chart->len > 0 ? chart->len : 1));
+	memset(run.origin_at[1], -1, sizeof(int) * (chart->len > 0 ? chart->len : 1));
+	run.sets[0] = ChartSet_create();
+	run.sets[1] = ChartSet_create();
+
+	// The start state is reached with an empty stack, which nothing waits on
+	ChartRun_add(&run, ChartRun_origin(&run, chart->start, 0), chart->start, 0);
+	while (1) {
+		int i = 0;
+		while (i < run.sets[0]->len || run.num_redo > 0) {
+			if (run.num_redo > 0) ChartRun_item(&run, run.redo[--run.num_redo]);
+			else ChartRun_item(&run, i++);
+		}
+		if (run.pos == len || run.sets[1]->len == 0) break;
+		struct ChartSet *tmp = run.sets[0];
+		run.sets[0] = run.sets[1];
+		run.sets[1] = tmp;
+		ChartSet_clear(run.sets[1]);
+		run.pos++;
+	}
+
+	int accepted = 0;
+	if (run.pos == len) {
+		for (int i = 0; i < run.sets[0]->len && !accepted; i++)
+			accepted = chart->final[run.sets[0]->items[i].state];
+	}
+	free(run.origins);
+	free(run.origin_at[0]);
+	free(run.origin_at[1]);
+	free(run.waiters);
+	free(run.waiter_slots);
+	free(run.redo);
+	ChartSet_destroy(run.sets[0]);
+	ChartSet_destroy(run.sets[1]);
+	return accepted;
+}
@@ -0,0 +1,31 @@
+#ifndef CHART_H_
+#define CHART_H_
+
+// One transition of a PDA in a chart: the state it goes to, the input
+// symbol it reads, the stack symbol it pops and the one it pushes ('\0'
+// for none of each)
+struct ChartMove {
+	int target;
+	char symbol;
+	char pop;
+	char push;
+};
+
+// Compiled form of any PDA for runs with -E. States are numbered in
+// automaton order and the moves of state s are moves[first[s]] up to
+// moves[first[s+1]]. A run is a chart parse of the input, like Earley's
+// algorithm for the grammar of the machine: it takes at most cubic time
+// in the input length and never copies a stack, however many branches
+// the machine has or however its empty string moves push.
+struct PDAChart {
+	int len;
+	int start;
+	char *final;
+	int *first;
+	struct ChartMove *moves;
+};
+
+struct PDAChart *PDAChart_create(struct Automaton *automaton);
+void PDAChart_destroy(struct PDAChart *chart);
+int PDAChart_accepts(struct PDAChart *chart, char *input, size_t len);
+#endif // CHART_H_
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include "auto.h"
+#include "dfa.h"
+
+struct DFATable *DFATable_create(struct Automaton *automaton)
+{
+	struct DFATable *table = malloc(sizeof(struct DFATable));
+	if (table == NULL) {
+		fprintf(stderr, "Error allocating memory for DFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	int len = automaton->len;
+	table->len = len;
+	table->start = -1;
+	table->map = NULL;
+	table->map_len = 0;
+	
+	// One class per distinct symbol, plus class 0 for everything else
+	memset(table->classmap, 0, sizeof(table->classmap));
+	table->nclasses = 1;
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			unsigned char c = (unsigned char)state->trans[j]->symbol;
+			if (c != '\0' && table->classmap[c] == 0)
+				table->classmap[c] = table->nclasses++;
+		}
+	}
+	int nclasses = table->nclasses;
+	
+	table->next = malloc(sizeof(int) * nclasses * (len > 0 ? len : 1));
+	table->final = malloc(sizeof(char) * (len > 0 ? len : 1));
+	table->states = malloc(sizeof(struct State *) * (len > 0 ? len : 1));
+	int *next = malloc(sizeof(int) * nclasses * (len > 0 ? len : 1));
+	char *live = malloc(sizeof(char) * (len > 0 ? len : 1));
+	char *sink = malloc(sizeof(char) * (len > 0 ? len : 1));
+	int *order = malloc(sizeof(int) * (len > 0 ? len : 1));
+	if (table->next == NULL || table->final == NULL || table->states == NULL ||
+			next == NULL || live == NULL || sink == NULL || order == NULL) {
+		fprintf(stderr, "Error allocating memory for transition table in DFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(next, -1, sizeof(int) * nclasses * len);
+
+	for (int i = 0; i < len; i++) automaton->states[i]->id = i;
+
+	// First listed transition wins, same as the linear scan it replaces
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		int *row = next + i * nclasses;
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			unsigned char c = (unsigned char)trans->symbol;
+			if (c == '\0' || row[table->classmap[c]] != -1) continue;
+			row[table->classmap[c]] = trans->state->id;
+		}
+	}
+	
+	// Reverse edges, for propagating liveness and sink removal backwards
+	int *rev_start = calloc(len + 1, sizeof(int));
+	int *rev = malloc(sizeof(int) * nclasses * (len > 0 ? len : 1));
+	int *work = malloc(sizeof(int) * (len > 0 ? len : 1));
+	if (rev_start == NULL || rev == NULL || work == NULL) {
+		fprintf(stderr, "Error allocating memory for reverse edges in DFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len * nclasses; i++)
+		if (next[i] >= 0) rev_start[next[i] + 1]++;
+	for (int i = 0; i < len; i++) rev_start[i+1] += rev_start[i];
+	for (int i = 0; i < len; i++) work[i] = rev_start[i];
+	for (int i = 0; i < len * nclasses; i++)
+		if (next[i] >= 0) rev[work[next[i]]++] = i / nclasses;
+	
+	// Live states can still reach a final state; the rest are dead
+	int work_len = 0;
+	for (int i = 0; i < len; i++) {
+		live[i] = automaton->states[i]->final ? 1 : 0;
+		if (live[i]) work[work_len++] = i;
+	}
+	while (work_len > 0) {
+		int t = work[--work_len];
+		for (int k = rev_start[t]; k < rev_start[t+1]; k++) {
+			if (!live[rev[k]]) {
+				live[rev[k]] = 1;
+				work[work_len++] = rev[k];
+			}
+		}
+	}
+	
+	// Accepting sinks are final states that every symbol keeps among
+	// accepting sinks: from there only a byte outside the alphabet rejects.
+	// They must also keep accepting the same patterns, since a run stops
+	// at the first one it reaches
+	for (int i = 0; i < len; i++) {
+		sink[i] = automaton->states[i]->final ? 1 : 0;
+		for (int c = 1; c < nclasses && sink[i]; c++) {
+			int t = next[i * nclasses + c];
+			if (t < 0 || !State_tags_equal(automaton->states[i], automaton->states[t]))
+				sink[i] = 0;
+		}
+		if (!sink[i]) work[work_len++] = i;
+	}
+	while (work_len > 0) {
+		int t = work[--work_len];
+		for (int k = rev_start[t]; k < rev_start[t+1]; k++) {
+			if (sink[rev[k]]) {
+				sink[rev[k]] = 0;
+				work[work_len++] = rev[k];
+			}
+		}
+	}
+	free(rev_start);
+	free(rev);
+	free(work);
+	
+	// Renumber with accepting sinks last so one bounds check on the state
+	// catches both a dead end (-1) and an accepting sink (>= table->live)
+	int id = 0;
+	for (int i = 0; i < len; i++)
+		if (!sink[i]) order[i] = id++;
+	table->live = id;
+	for (int i = 0; i < len; i++)
+		if (sink[i]) order[i] = id++;
+	
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		state->id = order[i];
+		table->states[order[i]] = state;
+		table->final[order[i]] = state->final ? 1 : 0;
+		for (int c = 0; c < nclasses; c++) {
+			int t = next[i * nclasses + c];
+			table->next[order[i] * nclasses + c] = (t >= 0 && live[t]) ? order[t] : -1;
+		}
+	}
+	for (int i = 0; i < len; i++)
+		if (automaton->states[i] == automaton->start && live[i])
+			table->start = order[i];
+	
+	free(next);
+	free(live);
+	free(sink);
+	free(order);
+	return table;
+}
+
+void DFATable_destroy(struct DFATable *table)
+{
+	if (table->map != NULL) {
+		munmap(table->map, table->map_len);
+	} else {
+		free(table->next);
+		free(table->final);
+	}
+	free(table->states);
+	free(table);
+}
+
+// Returns the state reached after consuming input, or -1 if the
+// machine ran out of transitions along the way
+int DFATable_run(struct DFATable *table, char *input)
+{
+	const int *next = table->next;
+	const unsigned char *classmap = table->classmap;
+	const int nclasses = table->nclasses;
+	const unsigned live = table->live;
+	const unsigned char *s = (const unsigned char *)input;
+	int state = table->start;
+	while (*s != '\0' && (unsigned)state < live) {
+		state = next[state * nclasses + classmap[*s]];
+		s++;
+	}
+	if (state >= (int)live) {
+		for (; *s != '\0'; s++)
+			if (classmap[*s] == 0) return -1;
+	}
+	return state;
+}
+
+// Advance from state over len bytes, which may include NULs or newlines.
+// Stops early at a dead end, or at an accepting sink once the rest of the
+// input is known to stay inside the alphabet.
+int DFATable_step(struct DFATable *table, int state, char *input, size_t len)
+{
+	const int *next = table->next;
+	const unsigned char *classmap = table->classmap;
+	const int nclasses = table->nclasses;
+	const unsigned live = table->live;
+	const unsigned char *s = (const unsigned char *)input;
+	const unsigned char *end = s + len;
+	while (s < end && (unsigned)state < live) {
+		state = next[state * nclasses + classmap[*s]];
+		s++;
+	}
+	if (state >= (int)live) {
+		for (; s < end; s++)
+			if (classmap[*s] == 0) return -1;
+	}
+	return state;
+}
+
+// Run every record in group, DFA_LANES of them in lockstep. Each lane's
+// next state depends only on its own previous state, so the table loads
+// of different lanes overlap instead of waiting on each other. Lanes
+// that finish are refilled from the group.
+void DFATable_run_many(struct DFATable *table, struct DFAGroup *group)
+{
+	const int *next = table->next;
+	const unsigned char *classmap = table->classmap;
+	const int nclasses = table->nclasses;
+	
+	const unsigned char *pos[DFA_LANES];
+	size_t left[DFA_LANES];
+	int state[DFA_LANES];
+	int record[DFA_LANES];
+	int queued = 0;
+	int active = 0;
+	
+	for (int l = 0; l < DFA_LANES; l++) {
+		record[l] = -1;
+		state[l] = -1;
+		left[l] = 0;
+	}
+	
+	while (1) {
+		// Retire finished lanes and refill them
+		for (int l = 0; l < DFA_LANES; l++) {
+			if (record[l] >= 0 && (left[l] == 0 || state[l] < 0 || state[l] >= table->live)) {
+				if (state[l] >= table->live)
+					state[l] = DFATable_step(table, state[l], (char *)pos[l], left[l]);
+				group->states[record[l]] = state[l];
+				// An idle lane must not keep stepping past its record
+				record[l] = -1;
+				state[l] = -1;
+				active--;
+			}
+			while (record[l] < 0 && queued < group->len) {
+				int r = queued++;
+				if (group->lens[r] == 0) {
+					group->states[r] = table->start;
+					continue;
+				}
+				record[l] = r;
+				pos[l] = (const unsigned char *)group->inputs[r];
+				left[l] = group->lens[r];
+				state[l] = table->start;
+				active++;
+			}
+		}
+		if (active == 0) break;
+		
+		// Step every live lane as far as the shortest one allows
+		size_t steps = (size_t)-1;
+		for (int l = 0; l < DFA_LANES; l++)
+			if (record[l] >= 0 && left[l] < steps) steps = left[l];
+		for (size_t i = 0; i < steps; i++) {
+			for (int l = 0; l < DFA_LANES; l++) {
+				if (state[l] >= 0)
+					state[l] = next[state[l] * nclasses + classmap[pos[l][i]]];
+			}
+		}
+		for (int l = 0; l < DFA_LANES; l++) {
+			if (record[l] >= 0) {
+				pos[l] += steps;
+				left[l] -= steps;
+			}
+		}
+	}
+}
+
+static void DFATable_emit_case(FILE *fp, int c)
+{
+	if (isalnum(c))
+		fprintf(fp, "\tcase '%c':\n", c);
+	else
+		fprintf(fp, "\tcase %d:\n", c);
+}
+
+// Write the DFA as C source: a TMF_DFA_NAME(input, len) function with one
+// label per state and its transitions inlined as a switch, plus a main that
+// runs stdin lines when compiled with -DTMF_DFA_MAIN
+void DFATable_emit(struct DFATable *table, FILE *fp)
+{
+	const int nclasses = table->nclasses;
+	
+	// Bytes of each class, in byte order
+	int class_start[257];
+	unsigned char class_bytes[256];
+	memset(class_start, 0, sizeof(class_start));
+	for (int c = 0; c < 256; c++) class_start[table->classmap[c] + 1]++;
+	for (int cls = 0; cls < nclasses; cls++) class_start[cls+1] += class_start[cls];
+	int fill[256];
+	memcpy(fill, class_start, sizeof(int) * nclasses);
+	for (int c = 0; c < 256; c++) class_bytes[fill[table->classmap[c]]++] = c;
+	int order[256];
+
+	fprintf(fp, "#include <stddef.h>\n\n");
+	fprintf(fp, "#ifndef TMF_DFA_NAME\n#define TMF_DFA_NAME dfa_accepts\n#endif\n\n");
+	fprintf(fp, "// Returns 1 if the DFA accepts the len bytes at input\n");
+	fprintf(fp, "int TMF_DFA_NAME(const char *input, size_t len)\n{\n");
+	fprintf(fp, "\tconst unsigned char *s = (const unsigned char *)input;\n");
+	fprintf(fp, "\tconst unsigned char *end = s + len;\n");
+	if (table->start < 0)
+		fprintf(fp, "\t(void)s;\n\t(void)end;\n\treturn 0;\n");
+	else
+		fprintf(fp, "\tgoto s%d;\n", table->start);
+
+	for (int i = 0; i < table->len && table->start >= 0; i++) {
+		char *name = table->states[i]->name;
+		if (strstr(name, "*/") == NULL)
+			fprintf(fp, "s%d: /* %s */\n", i, name);
+		else
+			fprintf(fp, "s%d:\n", i);
+		const int *row = table->next + i * nclasses;
+
+		// An accepting sink accepts unless a byte outside the alphabet follows
+		if (i >= table->live) {
+			fprintf(fp, "\tfor (; s < end; s++) {\n\t\tswitch (*s) {\n");
+			for (int k = class_start[1]; k < 256; k++) {
+				fprintf(fp, "\t");
+				DFATable_emit_case(fp, class_bytes[k]);
+			}
+			fprintf(fp, "\t\t\tcontinue;\n\t\tdefault:\n\t\t\treturn 0;\n\t\t}\n\t}\n\treturn 1;\n");
+			continue;
+		}
+
+		fprintf(fp, "\tif (s == end) return %d;\n", table->final[i] ? 1 : 0);
+		fprintf(fp, "\tswitch (*s++) {\n");
+		// Classes with the same target share one goto
+		int num_order = 0;
+		for (int cls = 1; cls < nclasses; cls++)
+			if (row[cls] >= 0) order[num_order++] = cls;
+		for (int j = 0; j < num_order; j++) {
+			int target = row[order[j]];
+			if (target < 0) continue;
+			for (int k = j; k < num_order; k++) {
+				int cls = order[k];
+				if (row[cls] != target) continue;
+				for (int b = class_start[cls]; b < class_start[cls+1]; b++)
+					DFATable_emit_case(fp, class_bytes[b]);
+				// Class 0 never has a transition, so it marks a class as done
+				if (k > j) order[k] = 0;
+			}
+			fprintf(fp, "\t\tgoto s%d;\n", target);
+		}
+		fprintf(fp, "\tdefault:\n\t\treturn 0;\n\t}\n");
+	}
+	fprintf(fp, "}\n");
+
+	fprintf(fp, "\n#ifdef TMF_DFA_MAIN\n");
+	fprintf(fp, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+	fprintf(fp, "int main(void)\n{\n");
+	fprintf(fp, "\tchar *line = NULL;\n\tsize_t max = 0;\n\tssize_t len;\n");
+	fprintf(fp, "\twhile ((len = getline(&line, &max, stdin)) != -1) {\n");
+	fprintf(fp, "\t\tif (len > 0 && line[len-1] == '\\n') line[--len] = '\\0';\n");
+	fprintf(fp, "\t\tif (len > 0 && line[len-1] == '\\r') line[--len] = '\\0';\n");
+	fprintf(fp, "\t\tprintf(\"=>%%s\\n\\t%%s\\n\", line, TMF_DFA_NAME(line, len) ? \"ACCEPTED\" : \"REJECTED\");\n");
+	fprintf(fp, "\t}\n\tfree(line);\n\treturn 0;\n}\n#endif\n");
+}
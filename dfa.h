@@ -0,0 +1,40 @@
+#ifndef DFA_H_
+#define DFA_H_
+
+#define DFA_LANES 8
+#define DFA_GROUP 256
+
+// Compiled form of a DFA: states renumbered 0..len-1 and a dense
+// next[state * nclasses + classmap[byte]] table, -1 where no transition
+// exists or it leads to a dead state. Class 0 holds every byte outside
+// the machine's alphabet. States numbered live and up are accepting
+// sinks, which only a byte outside the alphabet can leave. A table loaded
+// from a machine image keeps next and final inside the mapping at map.
+struct DFATable {
+	int len;
+	int live;
+	int start;
+	int nclasses;
+	unsigned char classmap[256];
+	int *next;
+	char *final;
+	struct State **states;
+	char *map;
+	size_t map_len;
+};
+
+// Records queued for DFATable_run_many
+struct DFAGroup {
+	int len;
+	char *inputs[DFA_GROUP];
+	size_t lens[DFA_GROUP];
+	int states[DFA_GROUP];
+};
+
+struct DFATable *DFATable_create(struct Automaton *automaton);
+void DFATable_destroy(struct DFATable *table);
+int DFATable_run(struct DFATable *table, char *input);
+int DFATable_step(struct DFATable *table, int state, char *input, size_t len);
+void DFATable_run_many(struct DFATable *table, struct DFAGroup *group);
+void DFATable_emit(struct DFATable *table, FILE *fp);
+#endif // DFA_H_
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "auto.h"
+#include "dfa.h"
+#include "image.h"
+
+#define IMAGE_ALIGN(n) (((n) + 3) & ~(size_t)3)
+
+struct ImagePool {
+	char *buf;
+	int len;
+	int max_len;
+};
+
+static int ImagePool_add(struct ImagePool *pool, char *str)
+{
+	if (str == NULL) return -1;
+	int len = strlen(str) + 1;
+	if (pool->len + len > pool->max_len) {
+		while (pool->len + len > pool->max_len) pool->max_len *= 2;
+		pool->buf = realloc(pool->buf, pool->max_len);
+		if (pool->buf == NULL) {
+			fprintf(stderr, "Error allocating memory for image string pool\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(pool->buf + pool->len, str, len);
+	pool->len += len;
+	return pool->len - len;
+}
+
+static void image_write(FILE *fp, const void *data, size_t len)
+{
+	static const char zeros[4] = {0};
+	if (len > 0) fwrite(data, 1, len, fp);
+	fwrite(zeros, 1, IMAGE_ALIGN(len) - len, fp);
+}
+
+// Write automaton, and its compiled DFA table if it is a DFA, as a
+// machine image. Written under a temporary name and renamed into place so
+// a concurrent reader never sees a partial image. Returns -1 on failure.
+int Automaton_save(struct Automaton *automaton, char *filename)
+{
+	if (automaton->table == NULL && isDFA(automaton) == 1)
+		automaton->table = DFATable_create(automaton);
+	struct DFATable *table = automaton->table;
+
+	struct ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, 4);
+	header.version = IMAGE_VERSION;
+	header.num_states = automaton->len;
+	header.start = -1;
+	header.tm_blank = tm_blank;
+	header.tm_bound = tm_bound;
+	header.tm_bound_halt = tm_bound_halt;
+	header.has_table = table != NULL;
+	if (table != NULL) {
+		header.table_len = table->len;
+		header.table_live = table->live;
+		header.table_start = table->start;
+		header.table_nclasses = table->nclasses;
+	}
+
+	int len = automaton->len;
+	struct ImageState *states = calloc(len > 0 ? len : 1, sizeof(struct ImageState));
+	int *ids = malloc(sizeof(int) * (len > 0 ? len : 1));
+	struct ImagePool pool = { malloc(256), 0, 256 };
+	if (states == NULL || ids == NULL || pool.buf == NULL) {
+		fprintf(stderr, "Error allocating memory for machine image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Transitions refer to states by index; ids is borrowed for the
+	// lookup and restored afterwards since the DFA table owns it
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		ids[i] = state->id;
+		state->id = i;
+		if (state == automaton->start) header.start = i;
+	}
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		states[i].name = ImagePool_add(&pool, state->name);
+		states[i].cmd = ImagePool_add(&pool, state->cmd);
+		states[i].first_arg = header.num_args;
+		while (state->cmd_args[states[i].num_args] != NULL) states[i].num_args++;
+		header.num_args += states[i].num_args;
+		states[i].first_trans = header.num_trans;
+		states[i].num_trans = state->num_trans;
+		header.num_trans += state->num_trans;
+		states[i].first_tag = header.num_tags;
+		states[i].num_tags = state->num_tags;
+		header.num_tags += state->num_tags;
+		states[i].id = ids[i];
+		states[i].final = state->final;
+		states[i].reject = state->reject;
+		states[i].start = state->start;
+	}
+
+	struct ImageTrans *trans = calloc(header.num_trans > 0 ? header.num_trans : 1, sizeof(struct ImageTrans));
+	int *args = malloc(sizeof(int) * (header.num_args > 0 ? header.num_args : 1));
+	int *tags = malloc(sizeof(int) * (header.num_tags > 0 ? header.num_tags : 1));
+	if (trans == NULL || args == NULL || tags == NULL) {
+		fprintf(stderr, "Error allocating memory for machine image\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			struct ImageTrans *t = &trans[states[i].first_trans + j];
+			t->state = state->trans[j]->state->id;
+			t->symbol = state->trans[j]->symbol;
+			t->readsym = state->trans[j]->readsym;
+			t->writesym = state->trans[j]->writesym;
+			t->direction = state->trans[j]->direction;
+		}
+		for (int j = 0; j < states[i].num_args; j++)
+			args[states[i].first_arg + j] = ImagePool_add(&pool, state->cmd_args[j]);
+		if (state->num_tags > 0)
+			memcpy(tags + states[i].first_tag, state->tags, sizeof(int) * state->num_tags);
+	}
+	for (int i = 0; i < len; i++) automaton->states[i]->id = ids[i];
+	header.strings_len = pool.len;
+
+	char *tmp = malloc(strlen(filename) + 32);
+	if (tmp == NULL) {
+		fprintf(stderr, "Error allocating memory for machine image\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmp, "%s.%ld.tmp", filename, (long)getpid());
+	FILE *fp = fopen(tmp, "wb");
+	int result = -1;
+	if (fp == NULL) {
+		fprintf(stderr, "Error opening %s\n", tmp);
+	} else {
+		image_write(fp, &header, sizeof(header));
+		image_write(fp, states, sizeof(struct ImageState) * len);
+		image_write(fp, trans, sizeof(struct ImageTrans) * header.num_trans);
+		image_write(fp, args, sizeof(int) * header.num_args);
+		image_write(fp, tags, sizeof(int) * header.num_tags);
+		image_write(fp, pool.buf, pool.len);
+		if (table != NULL) {
+			image_write(fp, table->classmap, sizeof(table->classmap));
+			image_write(fp, table->final, table->len);
+			image_write(fp, table->next, sizeof(int) * table->len * table->nclasses);
+		}
+		if (ferror(fp) | fclose(fp)) {
+			fprintf(stderr, "Error writing %s\n", tmp);
+			remove(tmp);
+		} else if (rename(tmp, filename) != 0) {
+			fprintf(stderr, "Error renaming %s to %s\n", tmp, filename);
+			remove(tmp);
+		} else {
+			result = 0;
+		}
+	}
+
+	free(tmp);
+	free(states);
+	free(ids);
+	free(trans);
+	free(args);
+	free(tags);
+	free(pool.buf);
+	return result;
+}
+
+// Returns 1 if filename starts with the machine image magic
+int isimage(char *filename)
+{
+	char magic[4];
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) return 0;
+	int result = fread(magic, 1, 4, fp) == 4 && memcmp(magic, IMAGE_MAGIC, 4) == 0;
+	fclose(fp);
+	return result;
+}
+
+static void image_invalid(char *filename)
+{
+	fprintf(stderr, "Error: %s is not a valid version %d machine image\n", filename, IMAGE_VERSION);
+	exit(EXIT_FAILURE);
+}
+
+// Returns 1 if entries first up to first + num lie in a section of len
+static int image_range(int first, int num, int len)
+{
+	return first >= 0 && num >= 0 && num <= len - first;
+}
+
+// Returns 1 if off starts a string in a pool of len bytes. The pool is
+// checked to end in a NUL, so every such string ends inside it
+static int image_string(int off, int len)
+{
+	return off >= 0 && off < len;
+}
+
+// Load a machine image. Everything taken from the file is checked before
+// it is used, so a truncated or stale image fails with image_invalid. The
+// DFA table is used straight from the mapping, so a compiled DFA is ready
+// to run without being rebuilt.
+struct Automaton *Automaton_load(char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct ImageHeader))
+		image_invalid(filename);
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Error mapping %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	struct ImageHeader *header = (struct ImageHeader *)map;
+	if (memcmp(header->magic, IMAGE_MAGIC, 4) != 0 || header->version != IMAGE_VERSION ||
+			header->num_states < 0 || header->num_trans < 0 ||
+			header->num_args < 0 || header->num_tags < 0 || header->strings_len < 0)
+		image_invalid(filename);
+
+	size_t off = IMAGE_ALIGN(sizeof(struct ImageHeader));
+	struct ImageState *states = (struct ImageState *)(map + off);
+	off += IMAGE_ALIGN(sizeof(struct ImageState) * header->num_states);
+	struct ImageTrans *trans = (struct ImageTrans *)(map + off);
+	off += IMAGE_ALIGN(sizeof(struct ImageTrans) * header->num_trans);
+	int *args = (int *)(map + off);
+	off += IMAGE_ALIGN(sizeof(int) * header->num_args);
+	int *tags = (int *)(map + off);
+	off += IMAGE_ALIGN(sizeof(int) * header->num_tags);
+	char *pool = map + off;
+	off += IMAGE_ALIGN(header->strings_len);
+	size_t table_off = off;
+	if (header->has_table) {
+		if (header->table_len != header->num_states || header->table_nclasses < 1 ||
+				header->table_nclasses > 256 || header->table_live < 0 ||
+				header->table_live > header->table_len || header->table_start < -1 ||
+				header->table_start >= header->table_len)
+			image_invalid(filename);
+		off += 256 + IMAGE_ALIGN(header->table_len);
+		off += sizeof(int) * header->table_len * header->table_nclasses;
+	}
+	if (off > (size_t)st.st_size || header->start >= header->num_states)
+		image_invalid(filename);
+	if (header->strings_len > 0 && pool[header->strings_len-1] != '\0')
+		image_invalid(filename);
+	for (int i = 0; i < header->num_states; i++) {
+		struct ImageState *s = &states[i];
+		if (!image_range(s->first_trans, s->num_trans, header->num_trans) ||
+				!image_range(s->first_arg, s->num_args, header->num_args) ||
+				!image_range(s->first_tag, s->num_tags, header->num_tags) ||
+				!image_string(s->name, header->strings_len) ||
+				(s->cmd != -1 && !image_string(s->cmd, header->strings_len)))
+			image_invalid(filename);
+	}
+	for (int i = 0; i < header->num_args; i++)
+		if (!image_string(args[i], header->strings_len)) image_invalid(filename);
+	if (header->has_table) {
+		const unsigned char *classmap = (unsigned char *)(map + table_off);
+		for (int c = 0; c < 256; c++)
+			if (classmap[c] >= header->table_nclasses) image_invalid(filename);
+		const int *next = (int *)(map + table_off + 256 + IMAGE_ALIGN(header->table_len));
+		size_t num_next = (size_t)header->table_len * header->table_nclasses;
+		for (size_t k = 0; k < num_next; k++)
+			if (next[k] < -1 || next[k] >= header->table_len) image_invalid(filename);
+	}
+
+	struct Automaton *automaton = Automaton_create();
+	int len = header->num_states;
+	automaton->max_len = len > 2 ? len : 2;
+	automaton->states = realloc(automaton->states, sizeof(struct State *) * automaton->max_len);
+	if (automaton->states == NULL) {
+		fprintf(stderr, "Error allocating memory for states array in automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len; i++) {
+		struct State *state = State_create(pool + states[i].name);
+		state->final = states[i].final;
+		state->reject = states[i].reject;
+		state->start = states[i].start;
+		if (states[i].cmd >= 0) state->cmd = strdup(pool + states[i].cmd);
+		if (states[i].num_args > 0) {
+			state->cmd_args = realloc(state->cmd_args, sizeof(char *) * (states[i].num_args + 1));
+			if (state->cmd_args == NULL) {
+				fprintf(stderr, "Error allocating memory for cmd_args within state\n");
+				exit(EXIT_FAILURE);
+			}
+			for (int j = 0; j < states[i].num_args; j++)
+				state->cmd_args[j] = strdup(pool + args[states[i].first_arg + j]);
+			state->cmd_args[states[i].num_args] = NULL;
+		}
+		for (int j = 0; j < states[i].num_tags; j++)
+			State_tag(state, tags[states[i].first_tag + j]);
+		automaton->states[i] = state;
+	}
+	automaton->len = len;
+	for (int i = 0; i < len; i++) {
+		for (int j = 0; j < states[i].num_trans; j++) {
+			struct ImageTrans *t = &trans[states[i].first_trans + j];
+			if (t->state < 0 || t->state >= len) image_invalid(filename);
+			Transition_add(automaton->states[i], Transition_create(t->symbol,
+				automaton->states[t->state], t->readsym, t->writesym, t->direction));
+		}
+	}
+	if (header->start >= 0) automaton->start = automaton->states[header->start];
+	tm_blank = header->tm_blank;
+	tm_bound = header->tm_bound;
+	tm_bound_halt = header->tm_bound_halt;
+
+	if (!header->has_table) {
+		munmap(map, st.st_size);
+		return automaton;
+	}
+
+	struct DFATable *table = malloc(sizeof(struct DFATable));
+	if (table == NULL) {
+		fprintf(stderr, "Error allocating memory for DFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	table->len = header->table_len;
+	table->live = header->table_live;
+	table->start = header->table_start;
+	table->nclasses = header->table_nclasses;
+	memcpy(table->classmap, map + table_off, 256);
+	table->final = map + table_off + 256;
+	table->next = (int *)(map + table_off + 256 + IMAGE_ALIGN(table->len));
+	table->states = calloc(len > 0 ? len : 1, sizeof(struct State *));
+	if (table->states == NULL) {
+		fprintf(stderr, "Error allocating memory for transition table in DFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < len; i++) {
+		if (states[i].id < 0 || states[i].id >= len || table->states[states[i].id] != NULL)
+			image_invalid(filename);
+		automaton->states[i]->id = states[i].id;
+		table->states[states[i].id] = automaton->states[i];
+	}
+	table->map = map;
+	table->map_len = st.st_size;
+	automaton->table = table;
+	return automaton;
+}
+
+// 64-bit FNV-1a, used to key the machine cache
+unsigned long long image_hash(unsigned long long hash, const void *data, size_t len)
+{
+	const unsigned char *s = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= s[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned long long image_hash_file(unsigned long long hash, char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error opening %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	char buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		hash = image_hash(hash, buf, n);
+	fclose(fp);
+	return hash;
+}
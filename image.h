@@ -0,0 +1,61 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#define IMAGE_MAGIC "TMFI"
+#define IMAGE_VERSION 2
+#define IMAGE_HASH_SEED 14695981039346656037ULL
+
+// Binary machine image, in file order: header, states, transitions,
+// command args, pattern tags, string pool, then the compiled DFA table if there is one.
+// Every section is padded to a multiple of 4 bytes so the mapped table
+// can be used in place.
+struct ImageHeader {
+	char magic[4];
+	int version;
+	int num_states;
+	int num_trans;
+	int num_args;
+	int num_tags;
+	int strings_len;
+	int start;
+	char tm_blank;
+	char tm_bound;
+	char tm_bound_halt;
+	char has_table;
+	int table_len;
+	int table_live;
+	int table_start;
+	int table_nclasses;
+};
+
+// Names and commands are offsets into the string pool, -1 for none
+struct ImageState {
+	int name;
+	int cmd;
+	int first_arg;
+	int num_args;
+	int first_trans;
+	int num_trans;
+	int first_tag;
+	int num_tags;
+	int id;
+	char final;
+	char reject;
+	char start;
+	char pad;
+};
+
+struct ImageTrans {
+	int state;
+	char symbol;
+	char readsym;
+	char writesym;
+	char direction;
+};
+
+int Automaton_save(struct Automaton *automaton, char *filename);
+int isimage(char *filename);
+struct Automaton *Automaton_load(char *filename);
+unsigned long long image_hash(unsigned long long hash, const void *data, size_t len);
+unsigned long long image_hash_file(unsigned long long hash, char *filename);
+#endif // IMAGE_H_
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auto.h"
+#include "nfa.h"
+
+#define NFA_SET(set, i) ((set)[(i) >> 6] |= 1ULL << ((i) & 63))
+#define NFA_HAS(set, i) ((set)[(i) >> 6] & (1ULL << ((i) & 63)))
+
+// Returns NULL if the machine uses a stack or tape, or if its masks would
+// take more than NFA_TABLE_MAX bytes
+struct NFATable *NFATable_create(struct Automaton *automaton)
+{
+	int len = automaton->len;
+	if (automaton->start == NULL) return NULL;
+	
+	unsigned char classmap[256];
+	memset(classmap, 0, sizeof(classmap));
+	int nclasses = 1;
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			if (trans->readsym != '\0' || trans->writesym != '\0' || trans->direction != '\0')
+				return NULL;
+			unsigned char c = (unsigned char)trans->symbol;
+			if (c != '\0' && classmap[c] == 0) classmap[c] = nclasses++;
+		}
+	}
+	int words = (len + 63) / 64;
+	if (words == 0) words = 1;
+	if ((double)len * (nclasses + 1) * words * sizeof(unsigned long long) > NFA_TABLE_MAX)
+		return NULL;
+	
+	struct NFATable *table = malloc(sizeof(struct NFATable));
+	if (table == NULL) {
+		fprintf(stderr, "Error allocating memory for NFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	table->len = len;
+	table->words = words;
+	table->nclasses = nclasses;
+	memcpy(table->classmap, classmap, sizeof(classmap));
+	table->start = calloc(words, sizeof(unsigned long long));
+	table->final = calloc(words, sizeof(unsigned long long));
+	table->succ = calloc((size_t)len * nclasses * words, sizeof(unsigned long long));
+	unsigned long long *closure = calloc((size_t)len * words, sizeof(unsigned long long));
+	int *work = malloc(sizeof(int) * (len > 0 ? len : 1));
+	int *ids = malloc(sizeof(int) * (len > 0 ? len : 1));
+	if (table->start == NULL || table->final == NULL || table->succ == NULL ||
+			closure == NULL || work == NULL || ids == NULL) {
+		fprintf(stderr, "Error allocating memory for bitsets in NFATable\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	// ids is borrowed for index lookups and restored afterwards
+	for (int i = 0; i < len; i++) {
+		ids[i] = automaton->states[i]->id;
+		automaton->states[i]->id = i;
+	}
+	
+	// Empty string closure of every state, computed once
+	for (int i = 0; i < len; i++) {
+		unsigned long long *set = closure + (size_t)i * words;
+		int work_len = 0;
+		NFA_SET(set, i);
+		work[work_len++] = i;
+		while (work_len > 0) {
+			struct State *state = automaton->states[work[--work_len]];
+			for (int j = 0; j < state->num_trans; j++) {
+				int t = state->trans[j]->state->id;
+				if (state->trans[j]->symbol == '\0' && !NFA_HAS(set, t)) {
+					NFA_SET(set, t);
+					work[work_len++] = t;
+				}
+			}
+		}
+	}
+	
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		if (state->final) NFA_SET(table->final, i);
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			unsigned char c = (unsigned char)trans->symbol;
+			if (c == '\0') continue;
+			unsigned long long *mask = table->succ + ((size_t)i * nclasses + classmap[c]) * words;
+			unsigned long long *add = closure + (size_t)trans->state->id * words;
+			for (int w = 0; w < words; w++) mask[w] |= add[w];
+		}
+	}
+	memcpy(table->start, closure + (size_t)automaton->start->id * words,
+		sizeof(unsigned long long) * words);
+	for (int i = 0; i < len; i++) automaton->states[i]->id = ids[i];
+	
+	free(closure);
+	free(work);
+	free(ids);
+	return table;
+}
+
+void NFATable_destroy(struct NFATable *table)
+{
+	free(table->start);
+	free(table->final);
+	free(table->succ);
+	free(table);
+}
+
+// Returns 1 if the NFA accepts the len bytes at input
+int NFATable_accepts(struct NFATable *table, char *input, size_t len)
+{
+	const int words = table->words;
+	const int nclasses = table->nclasses;
+	const unsigned char *s = (const unsigned char *)input;
+	unsigned long long buf[2 * 64];
+	unsigned long long *cur = buf;
+	unsigned long long *next = buf + words;
+	if (words > 64) {
+		cur = malloc(sizeof(unsigned long long) * words * 2);
+		if (cur == NULL) {
+			fprintf(stderr, "Error allocating memory for NFA state sets\n");
+			exit(EXIT_FAILURE);
+		}
+		next = cur + words;
+	}
+	unsigned long long *alloc = cur;
+	
+	memcpy(cur, table->start, sizeof(unsigned long long) * words);
+	int any = 1;
+	for (size_t i = 0; i < len && any; i++) {
+		int c = table->classmap[s[i]];
+		memset(next, 0, sizeof(unsigned long long) * words);
+		any = 0;
+		if (c != 0) {
+			for (int w = 0; w < words; w++) {
+				unsigned long long bits = cur[w];
+				while (bits) {
+					int state = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					const unsigned long long *mask = table->succ + ((size_t)state * nclasses + c) * words;
+					for (int v = 0; v < words; v++) next[v] |= mask[v];
+				}
+			}
+			for (int w = 0; w < words; w++)
+				if (next[w]) any = 1;
+		}
+		unsigned long long *tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+	
+	int accepted = 0;
+	if (any) {
+		for (int w = 0; w < words; w++)
+			if (cur[w] & table->final[w]) accepted = 1;
+	}
+	if (alloc != buf) free(alloc);
+	return accepted;
+}
+
+struct LazyDFA *LazyDFA_create(struct NFATable *nfa, size_t budget)
+{
+	struct LazyDFA *lazy = malloc(sizeof(struct LazyDFA));
+	if (lazy == NULL) {
+		fprintf(stderr, "Error allocating memory for LazyDFA\n");
+		exit(EXIT_FAILURE);
+	}
+	lazy->nfa = nfa;
+	lazy->budget = budget;
+	lazy->used = 0;
+	lazy->len = 0;
+	lazy->max_len = 16;
+	lazy->start = -1;
+	lazy->flushes = 0;
+	lazy->hash_size = 32;
+	lazy->sets = malloc(sizeof(unsigned long long) * nfa->words * lazy->max_len);
+	lazy->scratch = malloc(sizeof(unsigned long long) * nfa->words);
+	lazy->next = malloc(sizeof(int) * nfa->nclasses * lazy->max_len);
+	lazy->final = malloc(sizeof(char) * lazy->max_len);
+	lazy->hash = malloc(sizeof(int) * lazy->hash_size);
+	if (lazy->sets == NULL || lazy->scratch == NULL || lazy->next == NULL ||
+			lazy->final == NULL || lazy->hash == NULL) {
+		fprintf(stderr, "Error allocating memory for LazyDFA states\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(lazy->hash, -1, sizeof(int) * lazy->hash_size);
+	return lazy;
+}
+
+void LazyDFA_destroy(struct LazyDFA *lazy)
+{
+	free(lazy->sets);
+	free(lazy->scratch);
+	free(lazy->next);
+	free(lazy->final);
+	free(lazy->hash);
+	free(lazy);
+}
+
+static unsigned LazyDFA_hash(const unsigned long long *set, int words)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for (int w = 0; w < words; w++) {
+		h ^= set[w];
+		h *= 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	return (unsigned)h;
+}
+
+// Drop every cached state; the arrays are kept for reuse
+static void LazyDFA_flush(struct LazyDFA *lazy)
+{
+	lazy->len = 0;
+	lazy->used = 0;
+	lazy->start = -1;
+	lazy->flushes++;
+	memset(lazy->hash, -1, sizeof(int) * lazy->hash_size);
+}
+
+// Returns the cached state for set, adding it if it is new
+static int LazyDFA_add(struct LazyDFA *lazy, const unsigned long long *set)
+{
+	const int words = lazy->nfa->words;
+	const int nclasses = lazy->nfa->nclasses;
+	unsigned mask = lazy->hash_size - 1;
+	unsigned h = LazyDFA_hash(set, words) & mask;
+	while (lazy->hash[h] != -1) {
+		int id = lazy->hash[h];
+		if (memcmp(lazy->sets + (size_t)id * words, set, sizeof(unsigned long long) * words) == 0)
+			return id;
+		h = (h + 1) & mask;
+	}
+	
+	size_t cost = sizeof(unsigned long long) * words + sizeof(int) * (nclasses + 2) + 1;
+	if (lazy->len > 0 && lazy->used + cost > lazy->budget) {
+		LazyDFA_flush(lazy);
+		h = LazyDFA_hash(set, words) & mask;
+	}
+	
+	if (lazy->len == lazy->max_len) {
+		lazy->max_len *= 2;
+		lazy->sets = realloc(lazy->sets, sizeof(unsigned long long) * words * lazy->max_len);
+		lazy->next = realloc(lazy->next, sizeof(int) * nclasses * lazy->max_len);
+		lazy->final = realloc(lazy->final, sizeof(char) * lazy->max_len);
+		if (lazy->sets == NULL || lazy->next == NULL || lazy->final == NULL) {
+			fprintf(stderr, "Error allocating memory for LazyDFA states\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	// Keep the hash at most half full
+	if (2 * (lazy->len + 1) > lazy->hash_size) {
+		lazy->hash_size *= 2;
+		free(lazy->hash);
+		lazy->hash = malloc(sizeof(int) * lazy->hash_size);
+		if (lazy->hash == NULL) {
+			fprintf(stderr, "Error allocating memory for LazyDFA hash\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(lazy->hash, -1, sizeof(int) * lazy->hash_size);
+		mask = lazy->hash_size - 1;
+		for (int i = 0; i < lazy->len; i++) {
+			unsigned k = LazyDFA_hash(lazy->sets + (size_t)i * words, words) & mask;
+			while (lazy->hash[k] != -1) k = (k + 1) & mask;
+			lazy->hash[k] = i;
+		}
+		h = LazyDFA_hash(set, words) & mask;
+		while (lazy->hash[h] != -1) h = (h + 1) & mask;
+	}
+	
+	int id = lazy->len++;
+	lazy->used += cost;
+	lazy->hash[h] = id;
+	memcpy(lazy->sets + (size_t)id * words, set, sizeof(unsigned long long) * words);
+	for (int c = 0; c < nclasses; c++) lazy->next[(size_t)id * nclasses + c] = LAZY_UNKNOWN;
+	lazy->final[id] = 0;
+	for (int w = 0; w < words; w++)
+		if (set[w] & lazy->nfa->final[w]) lazy->final[id] = 1;
+	return id;
+}
+
+// Returns 1 if the NFA accepts the len bytes at input, filling in the
+// cached DFA along the way
+int LazyDFA_accepts(struct LazyDFA *lazy, char *input, size_t len)
+{
+	struct NFATable *nfa = lazy->nfa;
+	const int words = nfa->words;
+	const int nclasses = nfa->nclasses;
+	const unsigned char *s = (const unsigned char *)input;
+	
+	if (lazy->start < 0) lazy->start = LazyDFA_add(lazy, nfa->start);
+	int state = lazy->start;
+	for (size_t i = 0; i < len; i++) {
+		int c = nfa->classmap[s[i]];
+		if (c == 0) return 0;
+		int t = lazy->next[(size_t)state * nclasses + c];
+		if (t == LAZY_UNKNOWN) {
+			unsigned long long *next = lazy->scratch;
+			const unsigned long long *cur = lazy->sets + (size_t)state * words;
+			int any = 0;
+			memset(next, 0, sizeof(unsigned long long) * words);
+			for (int w = 0; w < words; w++) {
+				unsigned long long bits = cur[w];
+				while (bits) {
+					int q = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					const unsigned long long *mask = nfa->succ + ((size_t)q * nclasses + c) * words;
+					for (int v = 0; v < words; v++) next[v] |= mask[v];
+				}
+			}
+			for (int w = 0; w < words; w++)
+				if (next[w]) any = 1;
+			if (!any) {
+				t = -1;
+				lazy->next[(size_t)state * nclasses + c] = t;
+			} else {
+				// A flush while adding invalidates state, so only link
+				// the transition if the cache survived
+				long flushes = lazy->flushes;
+				t = LazyDFA_add(lazy, next);
+				if (flushes == lazy->flushes)
+					lazy->next[(size_t)state * nclasses + c] = t;
+			}
+		}
+		if (t < 0) return 0;
+		state = t;
+	}
+	return lazy->final[state];
+}
@@ -0,0 +1,47 @@
+#ifndef NFA_H_
+#define NFA_H_
+
+#define NFA_TABLE_MAX (1 << 26)
+#define LAZY_UNKNOWN -2
+
+// Compiled form of a stackless NFA. States are numbered in automaton
+// order and a set of states is a bitset of words 64-bit words. Each
+// state's successors on a symbol class are stored already closed under
+// empty string transitions, so a step is a union of masks.
+struct NFATable {
+	int len;
+	int words;
+	int nclasses;
+	unsigned char classmap[256];
+	unsigned long long *start;
+	unsigned long long *final;
+	unsigned long long *succ;
+};
+
+// DFA built from an NFATable while it runs. Each state is a set of NFA
+// states, and next holds LAZY_UNKNOWN until that transition is first
+// taken, or -1 if it leads to the empty set. When the cache would grow
+// past budget bytes it is flushed and rebuilt from the inputs that follow.
+struct LazyDFA {
+	struct NFATable *nfa;
+	size_t budget;
+	size_t used;
+	int len;
+	int max_len;
+	int start;
+	long flushes;
+	unsigned long long *sets;
+	unsigned long long *scratch;
+	int *next;
+	char *final;
+	int *hash;
+	int hash_size;
+};
+
+struct NFATable *NFATable_create(struct Automaton *automaton);
+void NFATable_destroy(struct NFATable *table);
+int NFATable_accepts(struct NFATable *table, char *input, size_t len);
+struct LazyDFA *LazyDFA_create(struct NFATable *nfa, size_t budget);
+void LazyDFA_destroy(struct LazyDFA *lazy);
+int LazyDFA_accepts(struct LazyDFA *lazy, char *input, size_t len);
+#endif // NFA_H_
@@ -21,20 +21,6 @@ int nsleep(double seconds)
 	return nanosleep(&req , &rem);
 }
 
-struct Automaton *e_closure(struct State *state)
-{
-	struct Automaton *a0 = Automaton_create();
-	State_add(a0, state);
-	for (int i = 0; i < a0->len; i++) {
-		for (int j = 0; j < a0->states[i]->num_trans; j++) {
-			if (a0->states[i]->trans[j]->symbol == '\0') {
-				State_add(a0, a0->states[i]->trans[j]->state);
-			}
-		}
-	}
-	return a0;
-}
-
 struct AutomatonList *AutomatonList_create()
 {
 	struct AutomatonList *al0 = malloc(sizeof(struct AutomatonList));
@@ -92,308 +78,639 @@ int Automaton_add(struct AutomatonList *al0, struct Automaton *a0)
 	return 1;
 }
 
-int AutomatonList_equiv(struct AutomatonList *al0, struct AutomatonList *al1)
-{
-	if (al0->len != al1->len) return 0;
-	if (al0->len == 0 && al1->len == 0) return 1;
-	for (int i = 0; i < al0->len; i++) {
-		struct Automaton *a0 = al0->automatons[i];
-		if (Automaton_get(al1, a0) == - 1) return 0; 
-	}
-	return 1;
-}
-
-int State_group_index(struct AutomatonList *al0, struct State *s0)
+// Append a new state named q<index> without the duplicate scan of State_add
+static struct State *State_append(struct Automaton *a0)
 {
-		for (int i = 0; i < al0->len; i++) {
-			struct State *stmp0 = State_get(al0->automatons[i], s0->name);
-			if (s0 == stmp0) return i;
+	char name[STATE_NAME_MAX];
+	snprintf(name, STATE_NAME_MAX, "q%d", a0->len);
+	struct State *state = State_create(name);
+	if (a0->len == a0->max_len) {
+		a0->max_len *= 2;
+		a0->states = realloc(a0->states, sizeof(struct State *) * a0->max_len);
+		if (a0->states == NULL) {
+			fprintf(stderr, "Memory error adding state name to automaton\n");
+			exit(EXIT_FAILURE);
 		}
-		return -1;
+	}
+	a0->states[a0->len++] = state;
+	return state;
 }
 
-// assumes s0 and s1 exist somewhere in al0
-int States_grouped(struct AutomatonList *al0, struct State *s0, struct State *s1)
+// Order states by their tags, then by id
+static int State_tags_compare(const void *a, const void *b)
 {
-	for (int i = 0; i < s0->num_trans; i++) {
-		for (int j = 0; j < s1->num_trans; j++) {
-			if (s0->trans[i]->symbol == s1->trans[j]->symbol) {
-				int s0_index = State_group_index(al0, s0->trans[i]->state);
-				int s1_index = State_group_index(al0, s1->trans[j]->state);
-				if (s0_index != s1_index) { //&& s0->trans[i]->state != s1->trans[i]->state)
-					//printf("%s[%d] and %s[%d] are NOT grouped\n", s0->name, s0_index, s1->name, s1_index);
-					return 0;
-				}
-			}
-		}
-	}
-	//printf("%s and %s are grouped\n", s0->name, s1->name);
-	return 1;
+	struct State *s0 = *(struct State **)a;
+	struct State *s1 = *(struct State **)b;
+	for (int i = 0; i < s0->num_tags && i < s1->num_tags; i++)
+		if (s0->tags[i] != s1->tags[i]) return s0->tags[i] < s1->tags[i] ? -1 : 1;
+	if (s0->num_tags != s1->num_tags) return s0->num_tags < s1->num_tags ? -1 : 1;
+	return (s0->id > s1->id) - (s0->id < s1->id);
 }
 
-
-struct AutomatonList *partition(struct AutomatonList *al0, struct Automaton *a0)
+// Hopcroft's algorithm over the states reachable from the start, numbered
+// in breadth first order. A missing transition goes to an implicit dead
+// state, whose class (and every transition into it) is left out of the
+// result. Each class is represented by its earliest member, and the
+// classes are named q0, q1, ... by breadth first order from the start
+// over the representatives' transitions.
+struct Automaton *DFA_minimize(struct Automaton *a0)
 {
-	struct AutomatonList *al1 = AutomatonList_create();
-	if (a0->len == 1) {
-		struct Automaton *new0 = Automaton_create();
-		State_add(new0, a0->states[0]);
-		Automaton_add(al1, new0);
-		return al1;
+	struct Automaton *min = Automaton_create();
+	if (a0->start == NULL) {
+		Automaton_compile(min);
+		return min;
 	}
 	
-	if (States_grouped(al0, a0->states[0], a0->states[1])) {
-		struct Automaton *new0 = Automaton_create();
-		State_add(new0, a0->states[0]);
-		State_add(new0, a0->states[1]);
-		Automaton_add(al1, new0);
-	} else {
-		struct Automaton *new0 = Automaton_create();
-		struct Automaton *new1 = Automaton_create();
-		State_add(new0, a0->states[0]);
-		State_add(new1, a0->states[1]);
-		Automaton_add(al1, new0);
-		Automaton_add(al1, new1);
+	int n = a0->len;
+	int *ids = malloc(sizeof(int) * (n > 0 ? n : 1));
+	struct State **order = malloc(sizeof(struct State *) * (n > 0 ? n : 1));
+	if (ids == NULL || order == NULL) {
+		fprintf(stderr, "Error allocating memory for DFA_minimize\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < n; i++) {
+		ids[i] = a0->states[i]->id;
+		a0->states[i]->id = -1;
 	}
 	
-	for (int i = 2; i < a0->len; i++) {
-		struct State *stmp = a0->states[i];
-		int matched = 0;
-		for (int j = 0; j < al1->len; j++) {
-			struct Automaton *atmp = al1->automatons[j];
-			if (States_grouped(al0, stmp, atmp->states[0])) {
-				State_add(atmp, stmp);
-				matched = 1;
-				break;
-			} 
-		}
-		if (!matched) {
-			struct Automaton *new0 = Automaton_create();
-			State_add(new0, stmp);
-			Automaton_add(al1, new0);
+	// Remove unreachable states
+	int m = 0;
+	order[m] = a0->start;
+	a0->start->id = m++;
+	for (int i = 0; i < m; i++) {
+		struct State *state = order[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			struct State *target = state->trans[j]->state;
+			if (target->id == -1) {
+				target->id = m;
+				order[m++] = target;
+			}
 		}
 	}
 	
-	return al1;
-}
-
-struct Automaton *purge_unreachable(struct Automaton *a0)
-{
-	struct Automaton *visited = Automaton_create();
-	
-	State_add(visited, a0->start);
-	struct State *state = a0->start;
-	for (int i = 0; i < visited->len; i++) {
-		struct State *stmp = visited->states[i];
-		for (int j = 0; j < stmp->num_trans; j++) {
-			State_add(visited, stmp->trans[j]->state);
+	unsigned char classmap[256];
+	memset(classmap, 0, sizeof(classmap));
+	int k = 0;
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < order[i]->num_trans; j++) {
+			unsigned char c = (unsigned char)order[i]->trans[j]->symbol;
+			if (classmap[c] == 0) classmap[c] = ++k;
 		}
 	}
-	visited->start = a0->start;
 	
-	return visited;
-}
-
-struct Automaton *DFA_minimize(struct Automaton *a0)
-{
-	// Remove unreachable states
-	struct Automaton *a1 = purge_unreachable(a0);
-	a0 = a1;
-	
-	// Set initial partition (final and non-final states)
-	struct Automaton *other = Automaton_create();
-	struct Automaton *final = Automaton_create();
-	for (int i = 0; i < a0->len; i++) {
-		if (a0->states[i]->final) State_add(final, a0->states[i]);
-		else State_add(other, a0->states[i]);
+	// First listed transition wins; the dead state, if needed, is m
+	int *delta = malloc(sizeof(int) * (size_t)(m + 1) * (k > 0 ? k : 1));
+	if (delta == NULL) {
+		fprintf(stderr, "Error allocating memory for transitions in DFA_minimize\n");
+		exit(EXIT_FAILURE);
 	}
+	memset(delta, -1, sizeof(int) * (size_t)(m + 1) * (k > 0 ? k : 1));
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < order[i]->num_trans; j++) {
+			struct Transition *trans = order[i]->trans[j];
+			int a = classmap[(unsigned char)trans->symbol] - 1;
+			if (delta[i * k + a] == -1) delta[i * k + a] = trans->state->id;
+		}
+	}
+	int partial = 0;
+	for (int i = 0; i < m * k; i++) {
+		if (delta[i] == -1) {
+			delta[i] = m;
+			partial = 1;
+		}
+	}
+	int len = m + partial;
+	for (int a = 0; a < k && partial; a++) delta[m * k + a] = m;
 	
-	
-	struct AutomatonList *al0 = AutomatonList_create();
-	struct AutomatonList *al1 = AutomatonList_create();
-	
-	if (other->len > 0) Automaton_add(al0, other);
-	else Automaton_clear(other);
-	if (final->len > 0) Automaton_add(al0, final);
-	else Automaton_clear(final);
-	
-	struct AutomatonList *al2;
-	for (int i = 0; i < al0->len; i++) {
-		al2 = partition(al0, al0->automatons[i]);
-		for (int j = 0; j < al2->len; j++)
-			Automaton_add(al1, al2->automatons[j]);
-		free(al2->automatons);
-		free(al2);
+	// Inverse transitions, grouped by (target, symbol)
+	int *inv_start = calloc((size_t)len * k + 1, sizeof(int));
+	int *inv = malloc(sizeof(int) * ((size_t)len * k > 0 ? (size_t)len * k : 1));
+	if (inv_start == NULL || inv == NULL) {
+		fprintf(stderr, "Error allocating memory for inverse transitions in DFA_minimize\n");
+		exit(EXIT_FAILURE);
 	}
+	for (int i = 0; i < len; i++)
+		for (int a = 0; a < k; a++)
+			inv_start[delta[i * k + a] * k + a + 1]++;
+	for (int i = 0; i < len * k; i++) inv_start[i+1] += inv_start[i];
+	int *fill = malloc(sizeof(int) * ((size_t)len * k > 0 ? (size_t)len * k : 1));
+	if (fill == NULL) {
+		fprintf(stderr, "Error allocating memory for inverse transitions in DFA_minimize\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(fill, inv_start, sizeof(int) * len * k);
+	for (int i = 0; i < len; i++)
+		for (int a = 0; a < k; a++)
+			inv[fill[delta[i * k + a] * k + a]++] = i;
+	free(fill);
 	
-	// Partition each set of states
-	while (!AutomatonList_equiv(al0, al1)) {
-		for (int i = 0; i < al0->len; i++) Automaton_clear(al0->automatons[i]);
-		free(al0->automatons);
-		free(al0);
-		al0 = al1;
-		al1 = AutomatonList_create();
-		
-		for (int i = 0; i < al0->len; i++) {
-			al2 = partition(al0, al0->automatons[i]);
-			for (int j = 0; j < al2->len; j++)
-				Automaton_add(al1, al2->automatons[j]);
-			free(al2->automatons);
-			free(al2);
+	// Partition: elems holds each block's states contiguously, with the
+	// marked ones first
+	int *elems = malloc(sizeof(int) * len);
+	int *loc = malloc(sizeof(int) * len);
+	int *block = malloc(sizeof(int) * len);
+	int *first = malloc(sizeof(int) * len);
+	int *end = malloc(sizeof(int) * len);
+	int *marked = calloc(len, sizeof(int));
+	char *in_work = calloc(len, sizeof(char));
+	int *work = malloc(sizeof(int) * len);
+	int *touched = malloc(sizeof(int) * len);
+	int *splitter = malloc(sizeof(int) * len);
+	if (elems == NULL || loc == NULL || block == NULL || first == NULL || end == NULL ||
+			marked == NULL || in_work == NULL || work == NULL || touched == NULL || splitter == NULL) {
+		fprintf(stderr, "Error allocating memory for partition in DFA_minimize\n");
+		exit(EXIT_FAILURE);
+	}
+	// Non-final states form one block, and final states one block for each
+	// set of patterns they accept
+	struct State **finals = malloc(sizeof(struct State *) * (m > 0 ? m : 1));
+	if (finals == NULL) {
+		fprintf(stderr, "Error allocating memory for partition in DFA_minimize\n");
+		exit(EXIT_FAILURE);
+	}
+	int num_blocks = 0, work_len = 0, pos = 0, num_finals = 0;
+	for (int i = 0; i < len; i++) {
+		if (i < m && order[i]->final) {
+			finals[num_finals++] = order[i];
+			continue;
 		}
+		elems[pos] = i;
+		loc[i] = pos++;
+		block[i] = num_blocks;
+	}
+	if (pos > 0) {
+		first[num_blocks] = 0;
+		end[num_blocks] = pos;
+		in_work[num_blocks] = 1;
+		work[work_len++] = num_blocks++;
 	}
+	qsort(finals, num_finals, sizeof(struct State *), State_tags_compare);
+	for (int i = 0; i < num_finals; i++) {
+		if (i == 0 || !State_tags_equal(finals[i-1], finals[i])) {
+			first[num_blocks] = pos;
+			in_work[num_blocks] = 1;
+			work[work_len++] = num_blocks++;
+		}
+		int q = finals[i]->id;
+		elems[pos] = q;
+		loc[q] = pos++;
+		block[q] = num_blocks - 1;
+		end[num_blocks - 1] = pos;
+	}
+	free(finals);
 	
-	// sort al1 by ascending distance from start state
-	int t[al1->len];
-	memset(t, -1, sizeof(t));
-	int t_len = 0;
-	for (int i = 0; i < al1->len && t_len < al1->len; i++) {
-		int state_index;
-		if (i == 0) {
-			state_index = State_group_index(al1, a0->start);
-			t[0] = state_index;
-			t_len++;
-		} else
-			state_index = t[i];
-		
-		struct Automaton *atmp = al1->automatons[state_index];
-		struct State *stmp = atmp->states[0];
-		for (int j = 0; j < stmp->num_trans && t_len < al1->len; j++) {
-			int trans_index = State_group_index(al1, stmp->trans[j]->state);
-			int contained = 0;
-			for (int k = 0; k < al1->len; k++) {
-				if (t[k] == trans_index) { 
-					contained = 1;
-					//printf("t already contains %d\n", trans_index);
-					break;
+	while (work_len > 0) {
+		int S = work[--work_len];
+		in_work[S] = 0;
+		int splitter_len = end[S] - first[S];
+		memcpy(splitter, elems + first[S], sizeof(int) * splitter_len);
+		for (int a = 0; a < k; a++) {
+			int touched_len = 0;
+			for (int i = 0; i < splitter_len; i++) {
+				int q = splitter[i];
+				for (int j = inv_start[q * k + a]; j < inv_start[q * k + a + 1]; j++) {
+					int p = inv[j];
+					int B = block[p];
+					int mark_pos = first[B] + marked[B];
+					if (loc[p] < mark_pos) continue;
+					if (marked[B] == 0) touched[touched_len++] = B;
+					int other = elems[mark_pos];
+					elems[loc[p]] = other;
+					loc[other] = loc[p];
+					elems[mark_pos] = p;
+					loc[p] = mark_pos;
+					marked[B]++;
 				}
 			}
-			
-			if (trans_index != state_index && !contained) {
-				t[t_len] = trans_index;
-				t_len++;
+			for (int t = 0; t < touched_len; t++) {
+				int B = touched[t];
+				if (marked[B] == end[B] - first[B]) {
+					marked[B] = 0;
+					continue;
+				}
+				int N = num_blocks++;
+				first[N] = first[B];
+				end[N] = first[B] + marked[B];
+				first[B] = end[N];
+				marked[B] = 0;
+				marked[N] = 0;
+				for (int i = first[N]; i < end[N]; i++) block[elems[i]] = N;
+				if (in_work[B] || end[N] - first[N] <= end[B] - first[B]) {
+					in_work[N] = 1;
+					work[work_len++] = N;
+				} else {
+					in_work[B] = 1;
+					work[work_len++] = B;
+				}
 			}
 		}
 	}
 	
-	al2 = AutomatonList_create();
-	for (int i = 0; i < al1->len; i++)
-		Automaton_add(al2, al1->automatons[t[i]]);
-	free(al1->automatons);
-	free(al1);
-	al1 = al2;
+	// Representatives are the earliest members in breadth first order
+	int *rep = malloc(sizeof(int) * num_blocks);
+	int *name = malloc(sizeof(int) * num_blocks);
+	if (rep == NULL || name == NULL) {
+		fprintf(stderr, "Error allocating memory for classes in DFA_minimize\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int b = 0; b < num_blocks; b++) {
+		rep[b] = -1;
+		name[b] = -1;
+	}
+	for (int i = len - 1; i >= 0; i--) rep[block[i]] = i;
+	int dead = partial ? block[m] : -1;
 	
-	// Fill min automaton with states
-	struct Automaton *min = Automaton_create();
-	for (int i = 0; i < al1->len; i++) {
-		char name[STATE_NAME_MAX];
-		snprintf(name, STATE_NAME_MAX, "q%d", i);
-		State_name_add(min, name);
+	int num_names = 0;
+	work_len = 0;
+	name[block[0]] = num_names++;
+	work[work_len++] = block[0];
+	for (int i = 0; i < work_len; i++) {
+		struct State *state = order[rep[work[i]]];
+		State_append(min);
+		if (work[i] == dead) break;
+		for (int j = 0; j < state->num_trans; j++) {
+			int b = block[state->trans[j]->state->id];
+			if (b != dead && name[b] == -1) {
+				name[b] = num_names++;
+				work[work_len++] = b;
+			}
+		}
 	}
 	
 	// Populate states with transitions
-	for (int i = 0; i < al1->len; i++) {	
-		
-		struct Automaton *atmp = al1->automatons[i];
-		struct State *stmp = atmp->states[0];
-		for (int j = 0; j < stmp->num_trans; j++) {
-			int trans_index = State_group_index(al1, stmp->trans[j]->state);
-			struct Transition *new_trans = Transition_create(stmp->trans[j]->symbol, min->states[trans_index], '\0', '\0', '\0');
+	for (int i = 0; i < min->len; i++) {
+		int b = work[i];
+		if (b == dead) break;
+		struct State *state = order[rep[b]];
+		for (int j = 0; j < state->num_trans; j++) {
+			int target = block[state->trans[j]->state->id];
+			if (target == dead) continue;
+			struct Transition *new_trans = Transition_create(state->trans[j]->symbol, min->states[name[target]], '\0', '\0', '\0');
 			Transition_add(min->states[i], new_trans);
 		}
-		
-		for (int j = 0; j < atmp->len; j++) {
-			if (atmp->states[j]->start) {
-				min->states[i]->start = 1;
-				min->start = min->states[i];
-			}
-			if (atmp->states[j]->final) {
-				min->states[i]->final = 1;
-				break;
-			}
-		}
+		if (state->final) min->states[i]->final = 1;
+		for (int t = 0; t < state->num_tags; t++)
+			State_tag(min->states[i], state->tags[t]);
 	}
+	min->start = min->states[0];
+	min->start->start = 1;
 	
-	Automaton_clear(a1);
+	for (int i = 0; i < n; i++) a0->states[i]->id = ids[i];
+	free(ids);
+	free(order);
+	free(delta);
+	free(inv_start);
+	free(inv);
+	free(elems);
+	free(loc);
+	free(block);
+	free(first);
+	free(end);
+	free(marked);
+	free(in_work);
+	free(work);
+	free(touched);
+	free(splitter);
+	free(rep);
+	free(name);
 	
-	for (int i = 0; i < al0->len; i++) Automaton_clear(al0->automatons[i]);
-	free(al0->automatons);
-	free(al0);
+	Automaton_compile(min);
+	return min;
+}
+
+static int int_compare(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+static unsigned Subsets_hash(const int *set, int len)
+{
+	unsigned h = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned)set[i];
+		h *= 16777619u;
+	}
+	return h ^ (unsigned)len;
+}
+
+struct Subsets *Subsets_create()
+{
+	struct Subsets *subsets = malloc(sizeof(struct Subsets));
+	if (subsets == NULL) {
+		fprintf(stderr, "Error allocating memory for Subsets\n");
+		exit(EXIT_FAILURE);
+	}
+	subsets->len = 0;
+	subsets->max_len = 64;
+	subsets->pool_len = 0;
+	subsets->pool_max = 1024;
+	subsets->hash_size = 128;
+	subsets->start = malloc(sizeof(size_t) * subsets->max_len);
+	subsets->lens = malloc(sizeof(int) * subsets->max_len);
+	subsets->pool = malloc(sizeof(int) * subsets->pool_max);
+	subsets->hash = malloc(sizeof(int) * subsets->hash_size);
+	if (subsets->start == NULL || subsets->lens == NULL || subsets->pool == NULL || subsets->hash == NULL) {
+		fprintf(stderr, "Error allocating memory for Subsets\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(subsets->hash, -1, sizeof(int) * subsets->hash_size);
+	return subsets;
+}
+
+void Subsets_destroy(struct Subsets *subsets)
+{
+	free(subsets->start);
+	free(subsets->lens);
+	free(subsets->pool);
+	free(subsets->hash);
+	free(subsets);
+}
+
+// Returns the index of the sorted set, adding it at the end if it is new
+int Subsets_add(struct Subsets *subsets, const int *set, int len)
+{
+	unsigned mask = subsets->hash_size - 1;
+	unsigned h = Subsets_hash(set, len) & mask;
+	while (subsets->hash[h] != -1) {
+		int i = subsets->hash[h];
+		if (subsets->lens[i] == len &&
+				memcmp(subsets->pool + subsets->start[i], set, sizeof(int) * len) == 0)
+			return i;
+		h = (h + 1) & mask;
+	}
 	
-	for (int i = 0; i < al1->len; i++) Automaton_clear(al1->automatons[i]);
-	free(al1->automatons);
-	free(al1);
+	if (subsets->len == subsets->max_len) {
+		subsets->max_len *= 2;
+		subsets->start = realloc(subsets->start, sizeof(size_t) * subsets->max_len);
+		subsets->lens = realloc(subsets->lens, sizeof(int) * subsets->max_len);
+		if (subsets->start == NULL || subsets->lens == NULL) {
+			fprintf(stderr, "Error reallocating memory for Subsets\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	while (subsets->pool_len + len > subsets->pool_max) {
+		subsets->pool_max *= 2;
+		subsets->pool = realloc(subsets->pool, sizeof(int) * subsets->pool_max);
+		if (subsets->pool == NULL) {
+			fprintf(stderr, "Error reallocating memory for Subsets pool\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	int i = subsets->len++;
+	subsets->start[i] = subsets->pool_len;
+	subsets->lens[i] = len;
+	memcpy(subsets->pool + subsets->pool_len, set, sizeof(int) * len);
+	subsets->pool_len += len;
+	subsets->hash[h] = i;
 	
-	return min;
+	// Keep the hash at most half full
+	if (2 * subsets->len > subsets->hash_size) {
+		subsets->hash_size *= 2;
+		free(subsets->hash);
+		subsets->hash = malloc(sizeof(int) * subsets->hash_size);
+		if (subsets->hash == NULL) {
+			fprintf(stderr, "Error reallocating memory for Subsets hash\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(subsets->hash, -1, sizeof(int) * subsets->hash_size);
+		mask = subsets->hash_size - 1;
+		for (int j = 0; j < subsets->len; j++) {
+			unsigned k = Subsets_hash(subsets->pool + subsets->start[j], subsets->lens[j]) & mask;
+			while (subsets->hash[k] != -1) k = (k + 1) & mask;
+			subsets->hash[k] = j;
+		}
+	}
+	return i;
 }
 
+// Subset construction. NFA states are numbered once, and for each state
+// and symbol the union of the empty string closures of its targets is
+// precomputed as a list. Subsets are kept as sorted lists of state numbers
+// in a hash table, and DFA states are named q0, q1, ... in the order they
+// are discovered. The empty subset becomes a trap state like any other.
 struct Automaton *nfa_to_dfa(struct Automaton *automaton)
 {
 	char alphabet[256];
-	*alphabet = '\0';
+	unsigned char classmap[256];
+	int nsym = 0;
+	memset(classmap, 0, sizeof(classmap));
 	for (int i = 0; i < automaton->len; i++) {
 		struct State *state = automaton->states[i];
 		for (int j = 0; j < state->num_trans; j++) {
-			if (strchr(alphabet, state->trans[j]->symbol) == NULL)
-				strncat(alphabet, &state->trans[j]->symbol, 1);
+			unsigned char c = (unsigned char)state->trans[j]->symbol;
+			if (c != '\0' && classmap[c] == 0) {
+				alphabet[nsym++] = c;
+				classmap[c] = nsym;
+			}
 		}
 	}
-
-	struct AutomatonList *al0 = AutomatonList_create();
-	struct Automaton *start = e_closure(automaton->start);
-	struct Automaton *a0 = Automaton_create();
-	Automaton_add(al0, start);
 	
-	for (int i = 0; i < al0->len; i++) {
-		char name[STATE_NAME_MAX];
-		snprintf(name, STATE_NAME_MAX, "q%d", i);
-		State_name_add(a0, name);
-
-		// Build AutomatonList (sets of sets of states)
-		for (int j = 0; alphabet[j] != '\0'; j++) {
-			struct Automaton *atmp = al0->automatons[i];
-			char symbol = alphabet[j];
-			struct Automaton *new_auto = Automaton_create();
-			for (int k = 0; k < atmp->len; k++) {
-				struct State *stmp = atmp->states[k];
-				for (int l = 0; l < stmp->num_trans; l++) {
-					if (symbol == stmp->trans[l]->symbol) {
-						struct Automaton *ectmp = e_closure(stmp->trans[l]->state);
-						for (int h = 0; h < ectmp->len; h++) {
-							State_add(new_auto, ectmp->states[h]);
+	int n = automaton->len;
+	int *ids = malloc(sizeof(int) * (n > 0 ? n : 1));
+	int *mark = calloc(n > 0 ? n : 1, sizeof(int));
+	int *work = malloc(sizeof(int) * (n > 0 ? n : 1));
+	int *cl_start = malloc(sizeof(int) * (n + 1));
+	if (ids == NULL || mark == NULL || work == NULL || cl_start == NULL) {
+		fprintf(stderr, "Error allocating memory for nfa_to_dfa\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < n; i++) {
+		ids[i] = automaton->states[i]->id;
+		automaton->states[i]->id = i;
+	}
+	
+	// Empty string closure of every state, computed once
+	int stamp = 0;
+	int cl_len = 0, cl_max = n > 0 ? n : 1;
+	int *cl = malloc(sizeof(int) * cl_max);
+	if (cl == NULL) {
+		fprintf(stderr, "Error allocating memory for closures in nfa_to_dfa\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < n; i++) {
+		cl_start[i] = cl_len;
+		stamp++;
+		int work_len = 0;
+		mark[i] = stamp;
+		work[work_len++] = i;
+		while (work_len > 0) {
+			int q = work[--work_len];
+			if (cl_len == cl_max) {
+				cl_max *= 2;
+				cl = realloc(cl, sizeof(int) * cl_max);
+				if (cl == NULL) {
+					fprintf(stderr, "Error allocating memory for closures in nfa_to_dfa\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			cl[cl_len++] = q;
+			struct State *state = automaton->states[q];
+			for (int j = 0; j < state->num_trans; j++) {
+				int t = state->trans[j]->state->id;
+				if (state->trans[j]->symbol == '\0' && mark[t] != stamp) {
+					mark[t] = stamp;
+					work[work_len++] = t;
+				}
+			}
+		}
+	}
+	cl_start[n] = cl_len;
+	
+	// Closed successors of each state, one (symbol, list) entry per symbol
+	int *ent_start = malloc(sizeof(int) * (n + 1));
+	int ent_len = 0, ent_max = 16;
+	int *ent_sym = malloc(sizeof(int) * ent_max);
+	int *ent_off = malloc(sizeof(int) * (ent_max + 1));
+	int succ_len = 0, succ_max = 1024;
+	int *succ = malloc(sizeof(int) * succ_max);
+	if (ent_start == NULL || ent_sym == NULL || ent_off == NULL || succ == NULL) {
+		fprintf(stderr, "Error allocating memory for successors in nfa_to_dfa\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < n; i++) {
+		struct State *state = automaton->states[i];
+		ent_start[i] = ent_len;
+		for (int j = 0; j < state->num_trans; j++) {
+			int c = classmap[(unsigned char)state->trans[j]->symbol];
+			if (c == 0) continue;
+			int seen = 0;
+			for (int e = ent_start[i]; e < ent_len; e++)
+				if (ent_sym[e] == c) seen = 1;
+			if (seen) continue;
+			if (ent_len == ent_max) {
+				ent_max *= 2;
+				ent_sym = realloc(ent_sym, sizeof(int) * ent_max);
+				ent_off = realloc(ent_off, sizeof(int) * (ent_max + 1));
+				if (ent_sym == NULL || ent_off == NULL) {
+					fprintf(stderr, "Error allocating memory for successors in nfa_to_dfa\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			ent_sym[ent_len] = c;
+			ent_off[ent_len] = succ_len;
+			stamp++;
+			for (int k = j; k < state->num_trans; k++) {
+				if (classmap[(unsigned char)state->trans[k]->symbol] != c) continue;
+				int t = state->trans[k]->state->id;
+				for (int m = cl_start[t]; m < cl_start[t+1]; m++) {
+					if (mark[cl[m]] == stamp) continue;
+					mark[cl[m]] = stamp;
+					if (succ_len == succ_max) {
+						succ_max *= 2;
+						succ = realloc(succ, sizeof(int) * succ_max);
+						if (succ == NULL) {
+							fprintf(stderr, "Error allocating memory for successors in nfa_to_dfa\n");
+							exit(EXIT_FAILURE);
 						}
-						Automaton_clear(ectmp);
 					}
+					succ[succ_len++] = cl[m];
 				}
 			}
-			// Add transitions
-			int added = Automaton_add(al0, new_auto);
-			int trans_index = Automaton_get(al0, new_auto);
-			if (!added) Automaton_clear(new_auto);
-			if (trans_index == a0->len) {
-				snprintf(name,STATE_NAME_MAX, "q%d", a0->len);
-				State_name_add(a0, name);
+			ent_len++;
+			ent_off[ent_len] = succ_len;
+		}
+	}
+	ent_start[n] = ent_len;
+	
+	struct Subsets *subsets = Subsets_create();
+	struct Automaton *a0 = Automaton_create();
+	int *set = malloc(sizeof(int) * (n > 0 ? n : 1));
+	int *bucket_len = calloc(nsym + 1, sizeof(int));
+	int *bucket_start = malloc(sizeof(int) * (nsym + 2));
+	int bucket_max = 16;
+	int *bucket = malloc(sizeof(int) * bucket_max);
+	if (set == NULL || bucket_len == NULL || bucket_start == NULL || bucket == NULL) {
+		fprintf(stderr, "Error allocating memory for nfa_to_dfa\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	int set_len = 0;
+	if (automaton->start != NULL) {
+		int s0 = automaton->start->id;
+		for (int m = cl_start[s0]; m < cl_start[s0+1]; m++) set[set_len++] = cl[m];
+	}
+	qsort(set, set_len, sizeof(int), int_compare);
+	Subsets_add(subsets, set, set_len);
+	State_append(a0);
+	
+	for (int i = 0; i < subsets->len; i++) {
+		// Bucket the successor entries of the members by symbol, so each
+		// symbol only visits the members that have a transition on it
+		const int *members = subsets->pool + subsets->start[i];
+		int members_len = subsets->lens[i];
+		memset(bucket_len, 0, sizeof(int) * (nsym + 1));
+		int total = 0;
+		for (int k = 0; k < members_len; k++) {
+			int q = members[k];
+			for (int e = ent_start[q]; e < ent_start[q+1]; e++) {
+				bucket_len[ent_sym[e]]++;
+				total++;
 			}
-			struct Transition *new_trans = Transition_create(symbol, a0->states[trans_index], '\0', '\0', '\0');
-			Transition_add(a0->states[i], new_trans);
 		}
-		// Set final states
-		for (int j = 0; j < al0->automatons[i]->len; j++) {
-			struct State *s0 = al0->automatons[i]->states[j];
-			if (s0->final) { 
-				a0->states[i]->final = 1;
-				break;
+		if (total > bucket_max) {
+			while (total > bucket_max) bucket_max *= 2;
+			bucket = realloc(bucket, sizeof(int) * bucket_max);
+			if (bucket == NULL) {
+				fprintf(stderr, "Error allocating memory for nfa_to_dfa\n");
+				exit(EXIT_FAILURE);
 			}
 		}
+		bucket_start[1] = 0;
+		for (int c = 1; c <= nsym; c++) bucket_start[c+1] = bucket_start[c] + bucket_len[c];
+		for (int k = 0; k < members_len; k++) {
+			int q = members[k];
+			for (int e = ent_start[q]; e < ent_start[q+1]; e++)
+				bucket[bucket_start[ent_sym[e]]++] = e;
+		}
+		
+		for (int c = 1; c <= nsym; c++) {
+			stamp++;
+			set_len = 0;
+			for (int b = bucket_start[c] - bucket_len[c]; b < bucket_start[c]; b++) {
+				int e = bucket[b];
+				for (int m = ent_off[e]; m < ent_off[e+1]; m++) {
+					if (mark[succ[m]] == stamp) continue;
+					mark[succ[m]] = stamp;
+					set[set_len++] = succ[m];
+				}
+			}
+			qsort(set, set_len, sizeof(int), int_compare);
+			int trans_index = Subsets_add(subsets, set, set_len);
+			if (trans_index == a0->len) State_append(a0);
+			struct Transition *new_trans = Transition_create(alphabet[c-1], a0->states[trans_index], '\0', '\0', '\0');
+			Transition_add(a0->states[i], new_trans);
+		}
+		
+		// Set final states, accepting every pattern their members accept
+		members = subsets->pool + subsets->start[i];
+		for (int k = 0; k < members_len; k++) {
+			struct State *member = automaton->states[members[k]];
+			if (!member->final) continue;
+			a0->states[i]->final = 1;
+			for (int t = 0; t < member->num_tags; t++)
+				State_tag(a0->states[i], member->tags[t]);
+		}
 	}
 	a0->start = a0->states[0];
 	a0->start->start = 1;
+	
+	for (int i = 0; i < n; i++) automaton->states[i]->id = ids[i];
+	Subsets_destroy(subsets);
+	free(ids);
+	free(mark);
+	free(work);
+	free(cl_start);
+	free(cl);
+	free(ent_start);
+	free(ent_sym);
+	free(ent_off);
+	free(succ);
+	free(set);
+	free(bucket_len);
+	free(bucket_start);
+	free(bucket);
 
-	for (int i = 0; i < al0->len; i++) {
-		Automaton_clear(al0->automatons[i]);
-	}
-	free(al0->automatons);
-	free(al0);
-
+	Automaton_compile(a0);
 	return a0;
 }
\ No newline at end of file
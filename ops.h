@@ -7,17 +7,27 @@ struct AutomatonList {
 	struct Automaton **automatons;
 };
 
+// Sets of NFA state numbers, each a sorted run of pool, found by hash
+struct Subsets {
+	int len;
+	int max_len;
+	size_t *start;
+	int *lens;
+	int *pool;
+	size_t pool_len;
+	size_t pool_max;
+	int *hash;
+	int hash_size;
+};
+
 int nsleep(double miliseconds);
-struct Automaton *e_closure(struct State *state);
 struct AutomatonList *AutomatonList_create();
 int Automaton_equiv(struct Automaton *a0, struct Automaton *a1);
 int Automaton_get(struct AutomatonList *al0, struct Automaton *a0);
 int Automaton_add(struct AutomatonList *al0, struct Automaton *a0);
-int AutomatonList_equiv(struct AutomatonList *al0, struct AutomatonList *al1);
-int State_group_index(struct AutomatonList *al0, struct State *s0);
-int States_grouped(struct AutomatonList *al0, struct State *s0, struct State *s1);
-struct AutomatonList *partition(struct AutomatonList *al0, struct Automaton *a0);
-struct Automaton *purge_unreachable(struct Automaton *a0);
+struct Subsets *Subsets_create();
+void Subsets_destroy(struct Subsets *subsets);
+int Subsets_add(struct Subsets *subsets, const int *set, int len);
 struct Automaton *nfa_to_dfa(struct Automaton *automaton);
 struct Automaton *DFA_minimize(struct Automaton *a0);
 #endif // OPS_H_
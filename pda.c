@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auto.h"
+#include "pda.h"
+
+// Build the table for a machine isDPDA accepts
+struct PDATable *PDATable_create(struct Automaton *automaton)
+{
+	struct PDATable *table = malloc(sizeof(struct PDATable));
+	if (table == NULL) {
+		fprintf(stderr, "Error allocating memory for PDATable\n");
+		exit(EXIT_FAILURE);
+	}
+	int len = automaton->len;
+	table->len = len;
+	table->start = -1;
+	
+	// One class per input symbol and per stack symbol read, after the
+	// empty string and the empty stack
+	memset(table->classmap, 0, sizeof(table->classmap));
+	memset(table->topmap, 0, sizeof(table->topmap));
+	table->ninput = 1;
+	table->ntop = 1;
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		for (int j = 0; j < state->num_trans; j++) {
+			unsigned char c = (unsigned char)state->trans[j]->symbol;
+			unsigned char r = (unsigned char)state->trans[j]->readsym;
+			if (c != '\0' && table->classmap[c] == 0)
+				table->classmap[c] = table->ninput++;
+			if (r != '\0' && table->topmap[r] == 0)
+				table->topmap[r] = table->ntop++;
+		}
+	}
+	int other = table->ntop++;
+	for (int c = 1; c < 256; c++)
+		if (table->topmap[c] == 0) table->topmap[c] = other;
+	
+	size_t size = (size_t)(len > 0 ? len : 1) * table->ninput * table->ntop;
+	table->final = malloc(sizeof(char) * (len > 0 ? len : 1));
+	table->moves = malloc(sizeof(struct PDAMove) * size);
+	int *ids = malloc(sizeof(int) * (len > 0 ? len : 1));
+	if (table->final == NULL || table->moves == NULL || ids == NULL) {
+		fprintf(stderr, "Error allocating memory for moves in PDATable\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < size; i++) {
+		table->moves[i].target = -1;
+		table->moves[i].pop = 0;
+		table->moves[i].push = '\0';
+	}
+	for (int i = 0; i < len; i++) {
+		ids[i] = automaton->states[i]->id;
+		automaton->states[i]->id = i;
+	}
+	
+	// A transition that reads nothing from the stack applies to every top
+	for (int i = 0; i < len; i++) {
+		struct State *state = automaton->states[i];
+		table->final[i] = state->final ? 1 : 0;
+		if (state == automaton->start) table->start = i;
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			unsigned char c = (unsigned char)trans->symbol;
+			unsigned char r = (unsigned char)trans->readsym;
+			struct PDAMove *row = table->moves + ((size_t)i * table->ninput + table->classmap[c]) * table->ntop;
+			for (int top = 0; top < table->ntop; top++) {
+				if (r != '\0' && top != table->topmap[r]) continue;
+				row[top].target = trans->state->id;
+				row[top].pop = r != '\0';
+				row[top].push = trans->writesym;
+			}
+		}
+	}
+	
+	for (int i = 0; i < len; i++) automaton->states[i]->id = ids[i];
+	free(ids);
+	return table;
+}
+
+void PDATable_destroy(struct PDATable *table)
+{
+	free(table->final);
+	free(table->moves);
+	free(table);
+}
+
+// Run input on one stack. A symbol move is taken when one applies, and
+// otherwise the empty string move: isDPDA only lets the two overlap when
+// nothing can be read after the empty string move. Empty string moves
+// have no cycles, so each run of them ends
+int PDATable_accepts(struct PDATable *table, char *input, size_t len)
+{
+	if (table->start < 0) return 0;
+	const struct PDAMove *moves = table->moves;
+	const unsigned char *classmap = table->classmap;
+	const unsigned char *topmap = table->topmap;
+	const int ninput = table->ninput;
+	const int ntop = table->ntop;
+	
+	size_t depth = 0;
+	size_t max_depth = 64;
+	char *stack = malloc(max_depth);
+	if (stack == NULL) {
+		fprintf(stderr, "Error allocating memory for PDA stack\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	int state = table->start;
+	int accepted = 0;
+	size_t i = 0;
+	while (1) {
+		if (i == len && table->final[state]) {
+			accepted = 1;
+			break;
+		}
+		int top = depth > 0 ? topmap[(unsigned char)stack[depth-1]] : 0;
+		const struct PDAMove *row = moves + (size_t)state * ninput * ntop + top;
+		const struct PDAMove *move = NULL;
+		if (i < len) {
+			int cls = classmap[(unsigned char)input[i]];
+			if (cls != 0 && row[cls * ntop].target >= 0) {
+				move = row + cls * ntop;
+				i++;
+			}
+		}
+		if (move == NULL) {
+			if (row->target < 0) break;
+			move = row;
+		}
+		state = move->target;
+		if (move->pop) depth--;
+		if (move->push != '\0') {
+			if (depth == max_depth) {
+				max_depth *= 2;
+				stack = realloc(stack, max_depth);
+				if (stack == NULL) {
+					fprintf(stderr, "Error reallocating memory for PDA stack\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			stack[depth++] = move->push;
+		}
+	}
+	free(stack);
+	return accepted;
+}
@@ -0,0 +1,32 @@
+#ifndef PDA_H_
+#define PDA_H_
+
+// One move of a deterministic PDA: the state it goes to, whether it pops
+// the top of the stack, and the symbol it pushes ('\0' for none)
+struct PDAMove {
+	int target;
+	char pop;
+	char push;
+};
+
+// Compiled form of a deterministic PDA. States are numbered in automaton
+// order and moves[(state * ninput + class) * ntop + top] is the move on
+// an input class (0 for the empty string) with a top of stack class (0
+// for an empty stack, ntop-1 for a symbol no transition reads), or has
+// target -1 if there is none. A run keeps one stack and allocates nothing
+// per input symbol.
+struct PDATable {
+	int len;
+	int start;
+	int ninput;
+	int ntop;
+	unsigned char classmap[256];
+	unsigned char topmap[256];
+	char *final;
+	struct PDAMove *moves;
+};
+
+struct PDATable *PDATable_create(struct Automaton *automaton);
+void PDATable_destroy(struct PDATable *table);
+int PDATable_accepts(struct PDATable *table, char *input, size_t len);
+#endif // PDA_H_
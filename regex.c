@@ -8,6 +8,12 @@
 struct CharStack *CharStack_create()
 {
 	struct CharStack *new_stack = malloc(sizeof(struct CharStack));
+	if (new_stack == NULL) {
+		fprintf(stderr, "Error allocating memory for CharStack\n");
+		exit(EXIT_FAILURE);
+	}
+	new_stack->len = 0;
+	new_stack->top = NULL;
 	return new_stack;
 }
 
@@ -70,6 +76,187 @@ void remove_spaces(char* s) {
 	} while (*s++ = *d++);
 }
 
+static void regex_invalid()
+{
+	fprintf(stderr, "Invalid regex\n");
+	exit(EXIT_FAILURE);
+}
+
+// Operands and postfix operators of a lexed regex
+static int is_operand(char c)
+{
+	return isalnum(c) || c == REGEX_CLASS;
+}
+
+static int is_unary(char c)
+{
+	return c == '*' || c == '+' || c == '?' || c == '{';
+}
+
+static void RegexParts_class(struct RegexParts *parts, const char *member)
+{
+	if (parts->num_classes == parts->max_classes) {
+		parts->max_classes = parts->max_classes ? parts->max_classes * 2 : 4;
+		parts->classes = realloc(parts->classes, sizeof(char *) * parts->max_classes);
+		if (parts->classes == NULL) {
+			fprintf(stderr, "Error allocating memory for regex classes\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	char *symbols = malloc(256);
+	if (symbols == NULL) {
+		fprintf(stderr, "Error allocating memory for regex classes\n");
+		exit(EXIT_FAILURE);
+	}
+	int len = 0;
+	for (int c = 1; c < 256; c++)
+		if (member[c]) symbols[len++] = c;
+	symbols[len] = '\0';
+	parts->classes[parts->num_classes++] = symbols;
+}
+
+static void RegexParts_repeat(struct RegexParts *parts, int min, int max)
+{
+	if (parts->num_repeats == parts->max_repeats) {
+		parts->max_repeats = parts->max_repeats ? parts->max_repeats * 2 : 4;
+		parts->min = realloc(parts->min, sizeof(int) * parts->max_repeats);
+		parts->max = realloc(parts->max, sizeof(int) * parts->max_repeats);
+		if (parts->min == NULL || parts->max == NULL) {
+			fprintf(stderr, "Error allocating memory for regex repeats\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	parts->min[parts->num_repeats] = min;
+	parts->max[parts->num_repeats++] = max;
+}
+
+void RegexParts_destroy(struct RegexParts *parts)
+{
+	for (int i = 0; i < parts->num_classes; i++)
+		free(parts->classes[i]);
+	free(parts->classes);
+	free(parts->min);
+	free(parts->max);
+}
+
+// Next symbol of a class at regex[*i], which may be escaped with '\'
+static unsigned char regex_class_symbol(char *regex, int *i)
+{
+	if (regex[*i] == '\\') (*i)++;
+	if (regex[*i] == '\0') regex_invalid();
+	return (unsigned char)regex[(*i)++];
+}
+
+// Class at regex[i] onwards, just past its '['. Returns the index of the
+// closing ']'
+static int regex_class(char *regex, int i, char *member)
+{
+	int negate = 0;
+	if (regex[i] == '^') {
+		negate = 1;
+		i++;
+	}
+	// A ']' straight after the '[' or '[^' is a member
+	int first = 1;
+	while (regex[i] != ']' || first) {
+		first = 0;
+		unsigned char lo = regex_class_symbol(regex, &i);
+		unsigned char hi = lo;
+		if (regex[i] == '-' && regex[i+1] != ']' && regex[i+1] != '\0') {
+			i++;
+			hi = regex_class_symbol(regex, &i);
+			if (hi < lo) regex_invalid();
+		}
+		for (int c = lo; c <= hi; c++) member[c] = 1;
+		if (regex[i] == '\0') regex_invalid();
+	}
+	if (negate) {
+		for (int c = 1; c < 256; c++)
+			member[c] = c != '\n' && !member[c];
+	}
+	return i;
+}
+
+// Bounds of a repeat at regex[i] onwards, just past its '{'. Returns the
+// index of the closing '}'
+static int regex_repeat(char *regex, int i, int *min, int *max)
+{
+	if (!isdigit(regex[i])) regex_invalid();
+	*min = 0;
+	while (isdigit(regex[i]) && *min <= REGEX_REPEAT_MAX)
+		*min = *min * 10 + regex[i++] - '0';
+	*max = *min;
+	if (regex[i] == ',') {
+		i++;
+		*max = -1;
+		if (isdigit(regex[i])) {
+			*max = 0;
+			while (isdigit(regex[i]) && *max <= REGEX_REPEAT_MAX)
+				*max = *max * 10 + regex[i++] - '0';
+		}
+	}
+	if (regex[i] != '}' || *min > REGEX_REPEAT_MAX || *max > REGEX_REPEAT_MAX ||
+			(*max != -1 && *max < *min))
+		regex_invalid();
+	return i;
+}
+
+// Swaps each class, '.', and escaped symbol for REGEX_CLASS and each
+// {m,n} for '{', recording them in parts in order. Spaces outside of
+// classes are dropped. Everything else is left for is_valid_regex
+char *regex_lex(char *regex, struct RegexParts *parts)
+{
+	memset(parts, 0, sizeof(struct RegexParts));
+	int len = strlen(regex);
+	char *lexed = malloc(sizeof(char) * (len + 1));
+	if (lexed == NULL) {
+		fprintf(stderr, "Error allocating memory for regex\n");
+		exit(EXIT_FAILURE);
+	}
+	int out = 0;
+	for (int i = 0; i < len; i++) {
+		char c = regex[i];
+		char member[256];
+		memset(member, 0, sizeof(member));
+		if (c == ' ') {
+			continue;
+		} else if (c == '[') {
+			i = regex_class(regex, i + 1, member);
+		} else if (c == '.') {
+			for (int b = 1; b < 256; b++) member[b] = b != '\n';
+		} else if (c == '\\') {
+			if (regex[++i] == '\0') regex_invalid();
+			if (isalnum(regex[i])) {
+				lexed[out++] = regex[i];
+				continue;
+			}
+			member[(unsigned char)regex[i]] = 1;
+		} else if (c == '{') {
+			int min, max;
+			i = regex_repeat(regex, i + 1, &min, &max);
+			RegexParts_repeat(parts, min, max);
+			lexed[out++] = '{';
+			continue;
+		} else {
+			lexed[out++] = c;
+			continue;
+		}
+		RegexParts_class(parts, member);
+		lexed[out++] = REGEX_CLASS;
+	}
+	lexed[out] = '\0';
+	return lexed;
+}
+
+// Postfix form of a regex, with its classes and repeats in parts
+char *regex_postfix(char *regex, struct RegexParts *parts)
+{
+	char *lexed = regex_lex(regex, parts);
+	char *postfix = infix(lexed);
+	free(lexed);
+	return postfix;
+}
+
 int is_valid_regex(char *regex)
 {
 	int state = 1;
@@ -78,7 +265,7 @@ int is_valid_regex(char *regex)
 		char c = regex[i];
 		switch (state) {
 			case 1:
-				if (isalnum(c)) state = 2;
+				if (is_operand(c)) state = 2;
 				//else if (c == '*' || c == '|') state = 0;
 				else if (c == '(') {
 					state = 5;
@@ -87,8 +274,8 @@ int is_valid_regex(char *regex)
 				else state = 0;
 				break;
 			case 2:
-				if (isalnum(c)) state = 2;
-				else if (c == '*' || c == '+') state = 3;
+				if (is_operand(c)) state = 2;
+				else if (is_unary(c)) state = 3;
 				else if (c == '|') state = 4;
 				else if (c == '(') {
 					state = 5;
@@ -96,7 +283,7 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 3:
-				if (isalnum(c)) state = 2;
+				if (is_operand(c)) state = 2;
 				//else if (c == '*') state = 0;
 				else if (c == '|') state = 4;
 				else if (c == '(') {
@@ -105,7 +292,7 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 4:
-				if (isalnum(c)) state = 2;
+				if (is_operand(c)) state = 2;
 				//else if (c == '*' || c == '|') state = 0;
 				else if (c == '(') {
 					state = 5;
@@ -113,7 +300,7 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 5:
-				if (isalnum(c)) state = 6;
+				if (is_operand(c)) state = 6;
 				//else if (c == '*' || c == '|') state = 0;
 				else if (c == '(') {
 					state = 5;
@@ -121,8 +308,8 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 6:
-				if (isalnum(c)) state = 6;
-				else if (c  == '*' || c == '+') state = 7;
+				if (is_operand(c)) state = 6;
+				else if (is_unary(c)) state = 7;
 				else if (c == '|') state = 8;
 				else if (c == ')') {
 					state = 9;
@@ -134,7 +321,7 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 7:
-				if (isalnum(c)) state = 6;
+				if (is_operand(c)) state = 6;
 				//else if (c == '*') state = 0;
 				else if (c == '|') state = 8;
 				else if (c == ')') {
@@ -147,7 +334,7 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 8:
-				if (isalnum(c)) state = 6;
+				if (is_operand(c)) state = 6;
 				//else if (c == '|' || c == '*' || c == ')') state = 0;
 				else if (c == '(') {
 					state = 5;
@@ -155,8 +342,8 @@ int is_valid_regex(char *regex)
 				} else state = 0;
 				break;
 			case 9:
-				if (isalnum(c)) state = 6;
-				else if (c == '*' || c == '+') state = 7;
+				if (is_operand(c)) state = 6;
+				else if (is_unary(c)) state = 7;
 				else if (c == ')') {
 					state = 9;
 					num_parens--;
@@ -188,48 +375,46 @@ char *infix(char *regex)
 	}
 
 	struct CharStack *stack = CharStack_create();
-	char *tmp = malloc(sizeof(char) * strlen(regex)*2);
-	*tmp = '\0';
+	// Every symbol and operator is written once, plus at most one
+	// implicit concatenation per symbol
+	char *tmp = malloc(sizeof(char) * (strlen(regex)*2 + 1));
+	if (tmp == NULL) {
+		fprintf(stderr, "Error allocating memory for postfix regex\n");
+		exit(EXIT_FAILURE);
+	}
+	int out = 0;
 	int concat_detect = 0;
 	for (int i = 0; regex[i] != '\0'; i++) {
 		if (concat_detect) {
 			char peek = CharStack_peek(stack);
-			while (peek == '*' || peek == '_' || peek == '+' && peek != '\0') {
+			while (is_unary(peek) || peek == '_') {
 				char c = CharStack_pop(stack);
-				strncat(tmp, &c, 1);
+				tmp[out++] = c;
 				peek = CharStack_peek(stack);
 			}
 			CharStack_push(stack, '_');
 			concat_detect = 0;
 		}
-		if (isalnum(regex[i]) && isalnum(regex[i+1]) || 
-				regex[i] == '*' && isalnum(regex[i+1]) ||
-				regex[i] == '+' && isalnum(regex[i+1]) ||
-				regex[i] == '*' && regex[i+1] == '(' ||
-				regex[i] == '+' && regex[i+1] == '(' ||
-				regex[i] == ')' && regex[i+1] == '(' ||
-				isalnum(regex[i]) && regex[i+1] == '(' ||
-				regex[i] == ')' && isalnum(regex[i+1])) {
+		if ((is_operand(regex[i]) || is_unary(regex[i]) || regex[i] == ')') &&
+				(is_operand(regex[i+1]) || regex[i+1] == '(')) {
 			concat_detect = 1;
 		}
 		
-		if (isalnum(regex[i])) {
-			strncat(tmp, &regex[i], 1);
-		} else if (regex[i] == '*' || regex[i] == '+') {
+		if (is_operand(regex[i])) {
+			tmp[out++] = regex[i];
+		} else if (is_unary(regex[i])) {
 			char peek = CharStack_peek(stack);
-			while (peek == '*' || peek == '+' && peek != '\0') {
+			while (is_unary(peek)) {
 				char c = CharStack_pop(stack);
-				strncat(tmp, &c, 1);
+				tmp[out++] = c;
 				peek = CharStack_peek(stack);
 			}
-			if (regex[i] == '*') 
-				CharStack_push(stack, '*');
-			else CharStack_push(stack, '+');
+			CharStack_push(stack, regex[i]);
 		} else if (regex[i] == '|') {
 			char peek = CharStack_peek(stack);
-			while (peek == '*' || peek == '+' || peek == '_' || peek == '|' && peek != '\0') {
+			while (is_unary(peek) || peek == '_' || peek == '|') {
 				char c = CharStack_pop(stack);
-				strncat(tmp, &c, 1);
+				tmp[out++] = c;
 				peek = CharStack_peek(stack);
 			}
 			CharStack_push(stack, '|');
@@ -239,7 +424,7 @@ char *infix(char *regex)
 			char peek = CharStack_peek(stack);
 			while (peek != '(' && peek != '\0') {
 				char c = CharStack_pop(stack);
-				strncat(tmp, &c, 1);
+				tmp[out++] = c;
 				peek = CharStack_peek(stack);
 			}
 			if (peek == '(') CharStack_pop(stack);
@@ -259,203 +444,535 @@ char *infix(char *regex)
 		}
 
 		char c = CharStack_pop(stack);
-		strncat(tmp, &c, 1);
+		tmp[out++] = c;
 		peek = CharStack_peek(stack);
 	}
+	tmp[out] = '\0';
 	CharStack_destroy(stack);
 	return tmp;
 }
 
-struct Automaton *Automaton_concat(struct Automaton *a0, struct Automaton *a1)
+static int NFABuilder_state(struct NFABuilder *builder)
 {
-	//struct Automaton *a0 = automaton_dup(auto0);
-	//struct Automaton *a1 = automaton_dup(auto1);
-	struct Automaton *new_auto = Automaton_create();
-
-	new_auto->start = a0->start;
-	for (int i = 0; i < a0->len; i++) {
-		if (a0->states[i]->final) {
-			struct Transition *new_trans = Transition_create('\0', a1->start, '\0', '\0', '\0');
-			a0->states[i]->final = 0;
-			Transition_add(a0->states[i], new_trans);
+	if (builder->len == builder->max_len) {
+		builder->max_len *= 2;
+		builder->states = realloc(builder->states, sizeof(struct State *) * builder->max_len);
+		builder->next = realloc(builder->next, sizeof(int) * builder->max_len);
+		builder->next_final = realloc(builder->next_final, sizeof(int) * builder->max_len);
+		if (builder->states == NULL || builder->next == NULL || builder->next_final == NULL) {
+			fprintf(stderr, "Error allocating memory for NFABuilder\n");
+			exit(EXIT_FAILURE);
 		}
-		State_add(new_auto, a0->states[i]);
-	}
-	
-	for (int i = 0; i < a1->len; i++) {
-		if (a1->states[i]->start) a1->states[i]->start = 0;
-		State_add(new_auto, a1->states[i]);
-	}
-
-	for (int i = 0; i < new_auto->len; i++) {
-		char name[STATE_NAME_MAX];
-		snprintf(name, STATE_NAME_MAX, "q%d", i);
-		free(new_auto->states[i]->name);
-		new_auto->states[i]->name = strdup(name);
 	}
-	
-	Automaton_clear(a0);
-	Automaton_clear(a1);
-	
-	return new_auto;
+	int id = builder->len++;
+	builder->states[id] = State_create("");
+	builder->next[id] = -1;
+	builder->next_final[id] = -1;
+	return id;
 }
 
-struct Automaton *Automaton_union(struct Automaton *a0, struct Automaton *a1)
+static void NFABuilder_epsilon(struct NFABuilder *builder, int from, int to)
 {
-	//struct Automaton *a0 = automaton_dup(auto0);
-	//struct Automaton *a1 = automaton_dup(auto1);
-	struct Automaton *new_auto = Automaton_create();
+	Transition_add(builder->states[from], Transition_create('\0', builder->states[to], '\0', '\0', '\0'));
+}
 
-	struct State *new_start = State_create("q0");
-	struct Transition *new_trans0 = Transition_create('\0', a0->start, '\0', '\0', '\0');
-	struct Transition *new_trans1 = Transition_create('\0', a1->start, '\0', '\0', '\0');
-	Transition_add(new_start, new_trans0);
-	Transition_add(new_start, new_trans1);
-	new_start->start = 1;
-	State_add(new_auto, new_start);
-	new_auto->start = new_start;
+// Thompson's construction for a symbol, concatenation, union, star and
+// plus, each in time proportional to the states and transitions it adds
+static struct NFAFrag NFAFrag_char(struct NFABuilder *builder, char symbol)
+{
+	struct NFAFrag frag;
+	int q0 = NFABuilder_state(builder);
+	int q1 = NFABuilder_state(builder);
+	builder->states[q0]->start = 1;
+	builder->states[q1]->final = 1;
+	Transition_add(builder->states[q0], Transition_create(symbol, builder->states[q1], '\0', '\0', '\0'));
+	builder->next[q0] = q1;
+	frag.start = q0;
+	frag.head = q0;
+	frag.tail = q1;
+	frag.final_head = q1;
+	frag.final_tail = q1;
+	return frag;
+}
 
-	for (int i = 0; i < a0->len; i++) {
-		State_add(new_auto, a0->states[i]);
-		if (a0->states[i]->start) a0->states[i]->start = 0;
-	}
-	for (int i = 0; i < a1->len; i++) {
-		State_add(new_auto, a1->states[i]);
-		if (a1->states[i]->start) a1->states[i]->start = 0;
+static struct NFAFrag NFAFrag_concat(struct NFABuilder *builder, struct NFAFrag a0, struct NFAFrag a1)
+{
+	for (int f = a0.final_head; f != -1; f = builder->next_final[f]) {
+		NFABuilder_epsilon(builder, f, a1.start);
+		builder->states[f]->final = 0;
 	}
+	builder->states[a1.start]->start = 0;
+	builder->next[a0.tail] = a1.head;
+	a0.tail = a1.tail;
+	a0.final_head = a1.final_head;
+	a0.final_tail = a1.final_tail;
+	return a0;
+}
 
-	for (int i = 1; i < new_auto->len; i++) {
-		char name[STATE_NAME_MAX];
-		snprintf(name, STATE_NAME_MAX, "q%d", i);
-		free(new_auto->states[i]->name);
-		new_auto->states[i]->name = strdup(name);
-	}
+static struct NFAFrag NFAFrag_union(struct NFABuilder *builder, struct NFAFrag a0, struct NFAFrag a1)
+{
+	struct NFAFrag frag;
+	int q0 = NFABuilder_state(builder);
+	NFABuilder_epsilon(builder, q0, a0.start);
+	NFABuilder_epsilon(builder, q0, a1.start);
+	builder->states[q0]->start = 1;
+	builder->states[a0.start]->start = 0;
+	builder->states[a1.start]->start = 0;
+	builder->next[q0] = a0.head;
+	builder->next[a0.tail] = a1.head;
+	builder->next_final[a0.final_tail] = a1.final_head;
+	frag.start = q0;
+	frag.head = q0;
+	frag.tail = a1.tail;
+	frag.final_head = a0.final_head;
+	frag.final_tail = a1.final_tail;
+	return frag;
+}
 
-	Automaton_clear(a0);
-	Automaton_clear(a1);
-	
-	return new_auto;
+static struct NFAFrag NFAFrag_star(struct NFABuilder *builder, struct NFAFrag a0)
+{
+	int q0 = NFABuilder_state(builder);
+	builder->states[q0]->start = 1;
+	builder->states[q0]->final = 1;
+	NFABuilder_epsilon(builder, q0, a0.start);
+	for (int f = a0.final_head; f != -1; f = builder->next_final[f])
+		NFABuilder_epsilon(builder, f, a0.start);
+	builder->states[a0.start]->start = 0;
+	builder->next[q0] = a0.head;
+	builder->next_final[q0] = a0.final_head;
+	a0.start = q0;
+	a0.head = q0;
+	a0.final_head = q0;
+	return a0;
 }
 
-struct Automaton *Automaton_star(struct Automaton *a0)
+static struct NFAFrag NFAFrag_plus(struct NFABuilder *builder, struct NFAFrag a0)
 {
-	//struct Automaton *a0 = automaton_dup(auto0);
-	struct Automaton *new_auto = Automaton_create();
+	for (int f = a0.final_head; f != -1; f = builder->next_final[f])
+		NFABuilder_epsilon(builder, f, a0.start);
+	return a0;
+}
 
-	struct State *new_start = State_create("q0");
-	new_start->start = 1;
-	new_start->final = 1;
-	
-	struct Transition *new_trans = Transition_create('\0', a0->start, '\0', '\0', '\0');
-	Transition_add(new_start, new_trans);
-	State_add(new_auto, new_start);
-	new_auto->start = new_start;
+// Two states joined by one transition per member of the class
+static struct NFAFrag NFAFrag_class(struct NFABuilder *builder, char *symbols)
+{
+	struct NFAFrag frag;
+	int q0 = NFABuilder_state(builder);
+	int q1 = NFABuilder_state(builder);
+	builder->states[q0]->start = 1;
+	builder->states[q1]->final = 1;
+	for (char *c = symbols; *c != '\0'; c++)
+		Transition_add(builder->states[q0], Transition_create(*c, builder->states[q1], '\0', '\0', '\0'));
+	builder->next[q0] = q1;
+	frag.start = q0;
+	frag.head = q0;
+	frag.tail = q1;
+	frag.final_head = q1;
+	frag.final_tail = q1;
+	return frag;
+}
 
-	for (int i = 0; i < a0->len; i++) {
-		if (a0->states[i]->final) {
-			new_trans = Transition_create('\0', a0->start, '\0', '\0', '\0');
-			Transition_add(a0->states[i], new_trans);
-		}
-		if (a0->states[i]->start) a0->states[i]->start = 0;
+// Only accepts the empty string
+static struct NFAFrag NFAFrag_empty(struct NFABuilder *builder)
+{
+	struct NFAFrag frag;
+	int q0 = NFABuilder_state(builder);
+	builder->states[q0]->start = 1;
+	builder->states[q0]->final = 1;
+	frag.start = q0;
+	frag.head = q0;
+	frag.tail = q0;
+	frag.final_head = q0;
+	frag.final_tail = q0;
+	return frag;
+}
 
-		char name[STATE_NAME_MAX];
-		snprintf(name, STATE_NAME_MAX, "q%d", i+1);
-		free(a0->states[i]->name);
-		a0->states[i]->name = strdup(name);
-		State_add(new_auto, a0->states[i]);
-	}
+// Like NFAFrag_star, without the loop back
+static struct NFAFrag NFAFrag_optional(struct NFABuilder *builder, struct NFAFrag a0)
+{
+	int q0 = NFABuilder_state(builder);
+	builder->states[q0]->start = 1;
+	builder->states[q0]->final = 1;
+	NFABuilder_epsilon(builder, q0, a0.start);
+	builder->states[a0.start]->start = 0;
+	builder->next[q0] = a0.head;
+	builder->next_final[q0] = a0.final_head;
+	a0.start = q0;
+	a0.head = q0;
+	a0.final_head = q0;
+	return a0;
+}
 
-	Automaton_clear(a0);
-	return new_auto;
+// Fresh states with the same transitions as a0, in the same order. The
+// ids of a0's states map them to their copies while copying
+static struct NFAFrag NFAFrag_copy(struct NFABuilder *builder, struct NFAFrag a0)
+{
+	struct NFAFrag frag;
+	frag.tail = -1;
+	for (int id = a0.head; id != -1; id = builder->next[id]) {
+		int copy = NFABuilder_state(builder);
+		builder->states[id]->id = copy;
+		builder->states[copy]->start = builder->states[id]->start;
+		builder->states[copy]->final = builder->states[id]->final;
+		if (frag.tail == -1) frag.head = copy;
+		else builder->next[frag.tail] = copy;
+		frag.tail = copy;
+		if (id == a0.tail) break;
+	}
+	for (int id = a0.head; id != -1; id = builder->next[id]) {
+		struct State *state = builder->states[id];
+		for (int j = 0; j < state->num_trans; j++) {
+			struct Transition *trans = state->trans[j];
+			Transition_add(builder->states[state->id], Transition_create(trans->symbol,
+				builder->states[trans->state->id], '\0', '\0', '\0'));
+		}
+		if (id == a0.tail) break;
+	}
+	frag.start = builder->states[a0.start]->id;
+	frag.final_head = -1;
+	frag.final_tail = -1;
+	for (int f = a0.final_head; f != -1; f = builder->next_final[f]) {
+		int copy = builder->states[f]->id;
+		if (frag.final_head == -1) frag.final_head = copy;
+		else builder->next_final[frag.final_tail] = copy;
+		frag.final_tail = copy;
+		if (f == a0.final_tail) break;
+	}
+	for (int id = a0.head; id != -1; id = builder->next[id]) {
+		builder->states[id]->id = -1;
+		if (id == a0.tail) break;
+	}
+	return frag;
 }
 
-struct Automaton *Automaton_plus(struct Automaton *a0)
+// a0{min,max}: min copies in a row, then max - min nested optional
+// copies, a0(a0(a0)?)? rather than a union of every count, so the size
+// grows linearly with max
+static struct NFAFrag NFAFrag_repeat(struct NFABuilder *builder, struct NFAFrag a0, int min, int max)
 {
-	struct Automaton *new_auto = Automaton_create();
-	new_auto->start = a0->start;
-	for (int i = 0; i < a0->len; i++) {
-		if (a0->states[i]->final) {
-			struct Transition *new_trans = Transition_create('\0', a0->start, '\0', '\0', '\0');
-			Transition_add(a0->states[i], new_trans);
+	int count = max == -1 ? (min > 0 ? min : 1) : max;
+	if (count == 0) {
+		for (int id = a0.head; id != -1; ) {
+			int next = builder->next[id];
+			State_destroy(builder->states[id]);
+			builder->states[id] = NULL;
+			if (id == a0.tail) break;
+			id = next;
 		}
-		State_add(new_auto, a0->states[i]);
+		return NFAFrag_empty(builder);
 	}
 	
-	Automaton_clear(a0);
+	// Copies are taken before a0 is joined to anything
+	struct NFAFrag *copies = malloc(sizeof(struct NFAFrag) * count);
+	if (copies == NULL) {
+		fprintf(stderr, "Error allocating memory for NFABuilder\n");
+		exit(EXIT_FAILURE);
+	}
+	copies[0] = a0;
+	for (int i = 1; i < count; i++)
+		copies[i] = NFAFrag_copy(builder, a0);
 	
-	return new_auto;
+	struct NFAFrag frag;
+	if (max == -1) {
+		if (min == 0) {
+			frag = NFAFrag_star(builder, copies[0]);
+		} else {
+			copies[min-1] = NFAFrag_plus(builder, copies[min-1]);
+			frag = copies[0];
+			for (int i = 1; i < min; i++)
+				frag = NFAFrag_concat(builder, frag, copies[i]);
+		}
+	} else {
+		struct NFAFrag rest;
+		if (max > min) {
+			rest = NFAFrag_optional(builder, copies[max-1]);
+			for (int i = max - 2; i >= min; i--)
+				rest = NFAFrag_optional(builder, NFAFrag_concat(builder, copies[i], rest));
+		}
+		if (min == 0) {
+			frag = rest;
+		} else {
+			frag = copies[0];
+			for (int i = 1; i < min; i++)
+				frag = NFAFrag_concat(builder, frag, copies[i]);
+			if (max > min) frag = NFAFrag_concat(builder, frag, rest);
+		}
+	}
+	free(copies);
+	return frag;
 }
 
-struct Automaton *Automaton_char(char symbol)
+void WordList_add(struct WordList *list, char *word)
 {
-	struct Automaton *a0 = Automaton_create();
-	struct State *q0 = State_create("q0");
-	struct State *q1 = State_create("q1");
-	
-	q0->start = 1;
-	q1->final = 1;
-	struct Transition *trans = Transition_create(symbol, q1, '\0', '\0', '\0');
-	Transition_add(q0, trans);
-	
-	State_add(a0, q0);
-	State_add(a0, q1);
-	
-	a0->start = q0;
-	return a0;
+	if (list->len == list->max_len) {
+		list->max_len = list->max_len ? list->max_len * 2 : 4;
+		list->words = realloc(list->words, sizeof(char *) * list->max_len);
+		if (list->words == NULL) {
+			fprintf(stderr, "Error allocating memory for WordList\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	list->words[list->len++] = word;
 }
 
-struct AutoStack *AutoStack_create()
+// Add every nonblank line of filename to list, as a pattern set
+void WordList_read(struct WordList *list, char *filename)
 {
-	struct AutoStack *as0 = malloc(sizeof(struct AutoStack));
-	if (as0 == NULL) {
-		fprintf(stderr, "Error allocating memory for AutoStack\n");
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error opening %s\n", filename);
 		exit(EXIT_FAILURE);
 	}
-	as0->len = 0;
-	return as0;
+	char *line = NULL;
+	size_t len = 0;
+	while (getline(&line, &len, fp) != -1) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[strspn(line, " \t")] == '\0') continue;
+		WordList_add(list, strdup(line));
+	}
+	free(line);
+	fclose(fp);
 }
 
-struct AutoNode *AutoNode_create(struct Automaton *a0)
+static char *word_join(char *a, char *b)
 {
-	struct AutoNode *n0 = malloc(sizeof(struct AutoNode));
-	if (n0 == NULL ) {
-		fprintf(stderr, "Error allocating memory for AutoNode\n");
+	size_t a_len = strlen(a), b_len = strlen(b);
+	char *word = malloc(a_len + b_len + 1);
+	if (word == NULL) {
+		fprintf(stderr, "Error allocating memory for WordList\n");
 		exit(EXIT_FAILURE);
 	}
-	n0->automaton = a0;
-	n0->next = NULL;
-	return n0;
+	memcpy(word, a, a_len);
+	memcpy(word + a_len, b, b_len + 1);
+	return word;
 }
 
-void AutoCharStack_push(struct AutoStack *stack, struct Automaton *a0)
+// Mark the subexpressions built as tries: trie_end[i] is the end of the
+// outermost literal alternation of REGEX_TRIE_MIN or more words starting
+// at postfix index i, or -1. A literal alternation only has symbols,
+// unions, and concatenations in which one side is a single word.
+static int *trie_spans(char *postfix, int len)
 {
-	struct AutoNode *new_top = AutoNode_create(a0);
-	new_top->next = stack->top;
-	stack->top = new_top;
-	stack->len++;
+	int *trie_end = malloc(sizeof(int) * (len > 0 ? len : 1));
+	int *start = malloc(sizeof(int) * (len > 0 ? len : 1));
+	long *words = malloc(sizeof(long) * (len > 0 ? len : 1));
+	if (trie_end == NULL || start == NULL || words == NULL) {
+		fprintf(stderr, "Error allocating memory for regex trie spans\n");
+		exit(EXIT_FAILURE);
+	}
+	// words is 0 for a subexpression that is not a literal alternation
+	int top = 0;
+	for (int i = 0; i < len; i++) {
+		char c = postfix[i];
+		trie_end[i] = -1;
+		if (is_operand(c)) {
+			start[top] = i;
+			words[top++] = isalnum(c) ? 1 : 0;
+			continue;
+		} else if (is_unary(c)) {
+			words[top-1] = 0;
+		} else if (c == '|') {
+			words[top-2] = (words[top-2] && words[top-1]) ? words[top-2] + words[top-1] : 0;
+			top--;
+		} else if (c == '_') {
+			long a = words[top-2], b = words[top-1];
+			words[top-2] = (a == 1 || b == 1) ? a * b : 0;
+			top--;
+		} else {
+			continue;
+		}
+		if (words[top-1] >= REGEX_TRIE_MIN)
+			trie_end[start[top-1]] = i;
+	}
+	free(start);
+	free(words);
+	return trie_end;
 }
 
-struct Automaton *AutoStack_pop(struct AutoStack *stack)
+// Words of the literal alternation postfix[begin..end]
+static struct WordList trie_words(char *postfix, int begin, int end)
 {
-	if (stack->top == NULL) return NULL;
-	struct Automaton *a0 = stack->top->automaton;
-	struct AutoNode *new_top = stack->top->next;
-	free(stack->top);
-	stack->top = new_top;
-	stack->len--;
-	return a0;
+	struct WordList *stack = calloc(end - begin + 1, sizeof(struct WordList));
+	if (stack == NULL) {
+		fprintf(stderr, "Error allocating memory for WordList\n");
+		exit(EXIT_FAILURE);
+	}
+	int top = 0;
+	for (int i = begin; i <= end; i++) {
+		char c = postfix[i];
+		if (isalnum(c)) {
+			char *word = malloc(2);
+			if (word == NULL) {
+				fprintf(stderr, "Error allocating memory for WordList\n");
+				exit(EXIT_FAILURE);
+			}
+			word[0] = c;
+			word[1] = '\0';
+			stack[top].len = 0;
+			stack[top].max_len = 0;
+			stack[top].words = NULL;
+			WordList_add(&stack[top++], word);
+		} else if (c == '|') {
+			for (int j = 0; j < stack[top-1].len; j++)
+				WordList_add(&stack[top-2], stack[top-1].words[j]);
+			free(stack[top-1].words);
+			top--;
+		} else if (c == '_') {
+			struct WordList *a = &stack[top-2], *b = &stack[top-1];
+			if (a->len == 1) {
+				for (int j = 0; j < b->len; j++) {
+					char *word = word_join(a->words[0], b->words[j]);
+					free(b->words[j]);
+					b->words[j] = word;
+				}
+				free(a->words[0]);
+				free(a->words);
+				*a = *b;
+			} else {
+				for (int j = 0; j < a->len; j++) {
+					char *word = word_join(a->words[j], b->words[0]);
+					free(a->words[j]);
+					a->words[j] = word;
+				}
+				free(b->words[0]);
+				free(b->words);
+			}
+			top--;
+		}
+	}
+	struct WordList list = stack[0];
+	free(stack);
+	return list;
 }
 
-void AutoStack_destroy(struct AutoStack *stack)
+static int Transition_symbol_compare(const void *a, const void *b)
 {
-	struct Automaton *a0 = AutoStack_pop(stack);
-	while(a0 != NULL) AutoStack_pop(stack);
-	free(stack);
+	const struct Transition *x = *(struct Transition * const *)a;
+	const struct Transition *y = *(struct Transition * const *)b;
+	return (unsigned char)x->symbol - (unsigned char)y->symbol;
 }
 
+static unsigned trie_hash(struct State *state)
+{
+	unsigned h = state->final ? 2166136261u : 84696351u;
+	for (int j = 0; j < state->num_trans; j++) {
+		h = (h ^ (unsigned char)state->trans[j]->symbol) * 16777619u;
+		h = (h ^ (unsigned)state->trans[j]->state->id) * 16777619u;
+	}
+	return h;
+}
+
+static int trie_equiv(struct State *s0, struct State *s1)
+{
+	if (s0->final != s1->final || s0->num_trans != s1->num_trans) return 0;
+	for (int j = 0; j < s0->num_trans; j++) {
+		if (s0->trans[j]->symbol != s1->trans[j]->symbol ||
+				s0->trans[j]->state != s1->trans[j]->state)
+			return 0;
+	}
+	return 1;
+}
+
+// Build the words of postfix[begin..end] as a trie, then merge nodes with
+// equal futures bottom up into a DAWG. The fragment has no empty string
+// transitions and at most one transition per symbol from each state.
+static struct NFAFrag NFAFrag_trie(struct NFABuilder *builder, char *postfix, int begin, int end)
+{
+	struct WordList list = trie_words(postfix, begin, end);
+	int first = builder->len;
+	int root = NFABuilder_state(builder);
+	for (int i = 0; i < list.len; i++) {
+		int node = root;
+		for (char *c = list.words[i]; *c != '\0'; c++) {
+			struct State *state = builder->states[node];
+			int child = -1;
+			for (int j = 0; j < state->num_trans; j++) {
+				if (state->trans[j]->symbol == *c) {
+					child = state->trans[j]->state->id;
+					break;
+				}
+			}
+			if (child == -1) {
+				child = NFABuilder_state(builder);
+				builder->states[child]->id = child;
+				Transition_add(builder->states[node], Transition_create(*c, builder->states[child], '\0', '\0', '\0'));
+			}
+			node = child;
+		}
+		builder->states[node]->final = 1;
+		free(list.words[i]);
+	}
+	free(list.words);
+	builder->states[root]->id = root;
+	
+	// Children are created after their parents, so walking back from the
+	// newest node sees every child before its parent
+	int num = builder->len - first;
+	int hash_size = 1;
+	while (hash_size < 2 * num) hash_size *= 2;
+	int *hash = malloc(sizeof(int) * hash_size);
+	int *canon = malloc(sizeof(int) * num);
+	if (hash == NULL || canon == NULL) {
+		fprintf(stderr, "Error allocating memory for regex trie\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(hash, -1, sizeof(int) * hash_size);
+	for (int id = builder->len - 1; id >= first; id--) {
+		struct State *state = builder->states[id];
+		for (int j = 0; j < state->num_trans; j++) {
+			int child = state->trans[j]->state->id;
+			state->trans[j]->state = builder->states[canon[child - first]];
+		}
+		qsort(state->trans, state->num_trans, sizeof(struct Transition *), Transition_symbol_compare);
+		unsigned h = trie_hash(state) & (hash_size - 1);
+		canon[id - first] = id;
+		while (hash[h] != -1) {
+			if (trie_equiv(state, builder->states[hash[h]])) {
+				canon[id - first] = hash[h];
+				break;
+			}
+			h = (h + 1) & (hash_size - 1);
+		}
+		if (canon[id - first] == id) hash[h] = id;
+	}
+	
+	struct NFAFrag frag;
+	frag.start = root;
+	frag.head = root;
+	frag.tail = root;
+	frag.final_head = -1;
+	frag.final_tail = -1;
+	builder->states[root]->start = 1;
+	for (int id = first; id < builder->len; id++) {
+		struct State *state = builder->states[id];
+		state->id = -1;
+		if (canon[id - first] != id) {
+			State_destroy(state);
+			builder->states[id] = NULL;
+			continue;
+		}
+		if (id != root) {
+			builder->next[frag.tail] = id;
+			frag.tail = id;
+		}
+		if (state->final) {
+			if (frag.final_head == -1) frag.final_head = id;
+			else builder->next_final[frag.final_tail] = id;
+			frag.final_tail = id;
+		}
+	}
+	free(hash);
+	free(canon);
+	return frag;
+}
+
+// Thompson's construction, with large literal alternations built as
+// tries. States are only named, q0 onwards in output order, once the
+// whole NFA is built.
 struct Automaton *regex_to_nfa(char *regex)
 {
-	char *regex_infix = infix(regex);
+	struct RegexParts parts;
+	char *regex_infix = regex_postfix(regex, &parts);
 	
 	// Regex = empty string;
 	if (regex_infix[0] == '\0') {
@@ -464,36 +981,487 @@ struct Automaton *regex_to_nfa(char *regex)
 		a0->states[0]->start = 1;
 		a0->states[0]->final = 1;
 		a0->start = a0->states[0];
+		RegexParts_destroy(&parts);
+		free(regex_infix);
 		return a0;
 	}
 
-	struct AutoStack *stack = AutoStack_create();
-	for (int i=0; regex_infix[i] != '\0'; i++) {
-		if (isalnum(regex_infix[i])) {
-			struct Automaton *a0 = Automaton_char(regex_infix[i]);
-			AutoCharStack_push(stack, a0);
-		} else if (regex_infix[i] == '*') {
-			struct Automaton *top = AutoStack_pop(stack);
-			struct Automaton *new_top = Automaton_star(top);
-			AutoCharStack_push(stack, new_top);	
-		} else if (regex_infix[i] == '+') {
-			struct Automaton *top = AutoStack_pop(stack);
-			struct Automaton *new_top = Automaton_plus(top);
-			AutoCharStack_push(stack, new_top);
-		} else if (regex_infix[i] == '|') {
-			struct Automaton *top = AutoStack_pop(stack);
-			struct Automaton *next = AutoStack_pop(stack);
-			struct Automaton *new_top = Automaton_union(next, top);
-			AutoCharStack_push(stack, new_top);
-		} else if (regex_infix[i] == '_') {
-			struct Automaton *top = AutoStack_pop(stack);
-			struct Automaton *next = AutoStack_pop(stack);
-			struct Automaton *new_top = Automaton_concat(next, top);
-			AutoCharStack_push(stack, new_top);
-		}
-	}
-	struct Automaton *a0 = AutoStack_pop(stack);
-	AutoStack_destroy(stack);
+	int len = strlen(regex_infix);
+	struct NFABuilder builder;
+	builder.len = 0;
+	builder.max_len = 2 * len + 2;
+	builder.states = malloc(sizeof(struct State *) * builder.max_len);
+	builder.next = malloc(sizeof(int) * builder.max_len);
+	builder.next_final = malloc(sizeof(int) * builder.max_len);
+	struct NFAFrag *stack = malloc(sizeof(struct NFAFrag) * len);
+	if (builder.states == NULL || builder.next == NULL || builder.next_final == NULL || stack == NULL) {
+		fprintf(stderr, "Error allocating memory for NFABuilder\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	int *trie_end = trie_spans(regex_infix, len);
+	int num_classes = 0;
+	int num_repeats = 0;
+	int top = 0;
+	for (int i = 0; i < len; i++) {
+		char c = regex_infix[i];
+		if (trie_end[i] != -1) {
+			stack[top++] = NFAFrag_trie(&builder, regex_infix, i, trie_end[i]);
+			i = trie_end[i];
+		} else if (isalnum(c)) {
+			stack[top++] = NFAFrag_char(&builder, c);
+		} else if (c == REGEX_CLASS) {
+			stack[top++] = NFAFrag_class(&builder, parts.classes[num_classes++]);
+		} else if (c == '?') {
+			stack[top-1] = NFAFrag_optional(&builder, stack[top-1]);
+		} else if (c == '{') {
+			stack[top-1] = NFAFrag_repeat(&builder, stack[top-1],
+				parts.min[num_repeats], parts.max[num_repeats]);
+			num_repeats++;
+		} else if (c == '*') {
+			stack[top-1] = NFAFrag_star(&builder, stack[top-1]);
+		} else if (c == '+') {
+			stack[top-1] = NFAFrag_plus(&builder, stack[top-1]);
+		} else if (c == '|') {
+			stack[top-2] = NFAFrag_union(&builder, stack[top-2], stack[top-1]);
+			top--;
+		} else if (c == '_') {
+			stack[top-2] = NFAFrag_concat(&builder, stack[top-2], stack[top-1]);
+			top--;
+		}
+	}
+	
+	struct Automaton *a0 = Automaton_create();
+	a0->max_len = builder.len;
+	a0->states = realloc(a0->states, sizeof(struct State *) * a0->max_len);
+	if (a0->states == NULL) {
+		fprintf(stderr, "Error allocating memory for states array in automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int id = stack[0].head; id != -1; id = builder.next[id]) {
+		struct State *state = builder.states[id];
+		char name[STATE_NAME_MAX];
+		snprintf(name, STATE_NAME_MAX, "q%d", a0->len);
+		free(state->name);
+		state->name = strdup(name);
+		a0->states[a0->len++] = state;
+	}
+	a0->start = builder.states[stack[0].start];
+	
+	free(builder.states);
+	free(builder.next);
+	free(builder.next_final);
+	free(stack);
+	free(trie_end);
+	RegexParts_destroy(&parts);
 	free(regex_infix);
 	return a0;
-}
\ No newline at end of file
+}
+
+void PosList_add(struct PosList *list, int pos)
+{
+	if (list->len == list->max_len) {
+		list->max_len = list->max_len ? list->max_len * 2 : 4;
+		list->items = realloc(list->items, sizeof(int) * list->max_len);
+		if (list->items == NULL) {
+			fprintf(stderr, "Error allocating memory for PosList\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	list->items[list->len++] = pos;
+}
+
+void PosList_append(struct PosList *list, struct PosList *other)
+{
+	for (int i = 0; i < other->len; i++) PosList_add(list, other->items[i]);
+}
+
+static int PosAutomaton_add(struct PosAutomaton *pa, char *symbols)
+{
+	if (pa->len == pa->max_len) {
+		pa->max_len *= 2;
+		pa->symbols = realloc(pa->symbols, sizeof(char *) * pa->max_len);
+		pa->follow = realloc(pa->follow, sizeof(struct PosList) * pa->max_len);
+		if (pa->symbols == NULL || pa->follow == NULL) {
+			fprintf(stderr, "Error allocating memory for position automaton\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	int pos = pa->len++;
+	pa->symbols[pos] = symbols;
+	memset(&pa->follow[pos], 0, sizeof(struct PosList));
+	return pos;
+}
+
+static struct PosFrag PosFrag_symbols(struct PosAutomaton *pa, char *symbols)
+{
+	struct PosFrag frag;
+	memset(&frag, 0, sizeof(struct PosFrag));
+	frag.lo = PosAutomaton_add(pa, symbols);
+	PosList_add(&frag.first, frag.lo);
+	PosList_add(&frag.last, frag.lo);
+	return frag;
+}
+
+static struct PosFrag PosFrag_union(struct PosFrag a, struct PosFrag b)
+{
+	PosList_append(&a.first, &b.first);
+	PosList_append(&a.last, &b.last);
+	a.nullable = a.nullable || b.nullable;
+	free(b.first.items);
+	free(b.last.items);
+	return a;
+}
+
+static struct PosFrag PosFrag_concat(struct PosAutomaton *pa, struct PosFrag a, struct PosFrag b)
+{
+	for (int j = 0; j < a.last.len; j++)
+		PosList_append(&pa->follow[a.last.items[j]], &b.first);
+	if (a.nullable) PosList_append(&a.first, &b.first);
+	if (b.nullable) PosList_append(&b.last, &a.last);
+	free(a.last.items);
+	free(b.first.items);
+	a.last = b.last;
+	a.nullable = a.nullable && b.nullable;
+	return a;
+}
+
+// Loops every last position back to the first ones, as for a+
+static struct PosFrag PosFrag_plus(struct PosAutomaton *pa, struct PosFrag a)
+{
+	for (int j = 0; j < a.last.len; j++)
+		PosList_append(&pa->follow[a.last.items[j]], &a.first);
+	return a;
+}
+
+// A copy of a, whose positions run from a.lo to hi, on fresh positions.
+// Only the positions of a follow its positions so far, so the copy is a
+// shift of the whole range
+static struct PosFrag PosFrag_copy(struct PosAutomaton *pa, struct PosFrag a, int hi)
+{
+	int shift = pa->len - a.lo;
+	for (int p = a.lo; p <= hi; p++) {
+		int copy = PosAutomaton_add(pa, pa->symbols[p]);
+		for (int j = 0; j < pa->follow[p].len; j++)
+			PosList_add(&pa->follow[copy], pa->follow[p].items[j] + shift);
+	}
+	struct PosFrag frag;
+	memset(&frag, 0, sizeof(struct PosFrag));
+	frag.nullable = a.nullable;
+	frag.lo = a.lo + shift;
+	for (int j = 0; j < a.first.len; j++)
+		PosList_add(&frag.first, a.first.items[j] + shift);
+	for (int j = 0; j < a.last.len; j++)
+		PosList_add(&frag.last, a.last.items[j] + shift);
+	return frag;
+}
+
+// Same shape as NFAFrag_repeat
+static struct PosFrag PosFrag_repeat(struct PosAutomaton *pa, struct PosFrag a, int min, int max)
+{
+	int count = max == -1 ? (min > 0 ? min : 1) : max;
+	if (count == 0) {
+		// a holds the newest positions, so they can just be dropped
+		for (int p = a.lo; p < pa->len; p++)
+			free(pa->follow[p].items);
+		pa->len = a.lo;
+		free(a.first.items);
+		free(a.last.items);
+		memset(&a, 0, sizeof(struct PosFrag));
+		a.nullable = 1;
+		a.lo = pa->len;
+		return a;
+	}
+	
+	struct PosFrag *copies = malloc(sizeof(struct PosFrag) * count);
+	if (copies == NULL) {
+		fprintf(stderr, "Error allocating memory for position automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	copies[0] = a;
+	int hi = pa->len - 1;
+	for (int i = 1; i < count; i++)
+		copies[i] = PosFrag_copy(pa, a, hi);
+	
+	struct PosFrag frag;
+	if (max == -1) {
+		copies[count-1] = PosFrag_plus(pa, copies[count-1]);
+		if (min == 0) copies[0].nullable = 1;
+		frag = copies[0];
+		for (int i = 1; i < count; i++)
+			frag = PosFrag_concat(pa, frag, copies[i]);
+	} else {
+		struct PosFrag rest;
+		if (max > min) {
+			rest = copies[max-1];
+			rest.nullable = 1;
+			for (int i = max - 2; i >= min; i--) {
+				rest = PosFrag_concat(pa, copies[i], rest);
+				rest.nullable = 1;
+			}
+		}
+		if (min == 0) {
+			frag = rest;
+		} else {
+			frag = copies[0];
+			for (int i = 1; i < min; i++)
+				frag = PosFrag_concat(pa, frag, copies[i]);
+			if (max > min) frag = PosFrag_concat(pa, frag, rest);
+		}
+	}
+	free(copies);
+	return frag;
+}
+
+// Position (Glushkov) automaton: state 0 is the start and state i is the
+// i-th position, entered on any of its symbols. It has no empty string
+// transitions
+struct Automaton *regex_to_glushkov(char *regex)
+{
+	struct RegexParts parts;
+	char *postfix = regex_postfix(regex, &parts);
+	int len = strlen(postfix);
+	
+	// Plain symbols are positions matching just themselves
+	char singles[256][2];
+	for (int c = 0; c < 256; c++) {
+		singles[c][0] = c;
+		singles[c][1] = '\0';
+	}
+	
+	struct PosAutomaton pa;
+	pa.len = 0;
+	pa.max_len = len + 1;
+	pa.symbols = malloc(sizeof(char *) * pa.max_len);
+	pa.follow = malloc(sizeof(struct PosList) * pa.max_len);
+	struct PosFrag *stack = malloc(sizeof(struct PosFrag) * (len > 0 ? len : 1));
+	if (pa.symbols == NULL || pa.follow == NULL || stack == NULL) {
+		fprintf(stderr, "Error allocating memory for position automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	PosAutomaton_add(&pa, singles[0]);
+	
+	int num_classes = 0;
+	int num_repeats = 0;
+	int top = 0;
+	for (int i = 0; i < len; i++) {
+		char c = postfix[i];
+		if (isalnum(c)) {
+			stack[top++] = PosFrag_symbols(&pa, singles[(unsigned char)c]);
+		} else if (c == REGEX_CLASS) {
+			stack[top++] = PosFrag_symbols(&pa, parts.classes[num_classes++]);
+		} else if (c == '*' || c == '+') {
+			stack[top-1] = PosFrag_plus(&pa, stack[top-1]);
+			if (c == '*') stack[top-1].nullable = 1;
+		} else if (c == '?') {
+			stack[top-1].nullable = 1;
+		} else if (c == '{') {
+			stack[top-1] = PosFrag_repeat(&pa, stack[top-1],
+				parts.min[num_repeats], parts.max[num_repeats]);
+			num_repeats++;
+		} else if (c == '|') {
+			stack[top-2] = PosFrag_union(stack[top-2], stack[top-1]);
+			top--;
+		} else if (c == '_') {
+			stack[top-2] = PosFrag_concat(&pa, stack[top-2], stack[top-1]);
+			top--;
+		}
+	}
+	
+	struct Automaton *a0 = Automaton_create();
+	a0->max_len = pa.len;
+	a0->states = realloc(a0->states, sizeof(struct State *) * a0->max_len);
+	if (a0->states == NULL) {
+		fprintf(stderr, "Error allocating memory for states array in automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < pa.len; i++) {
+		char name[STATE_NAME_MAX];
+		snprintf(name, STATE_NAME_MAX, "q%d", i);
+		a0->states[i] = State_create(name);
+	}
+	a0->len = pa.len;
+	a0->start = a0->states[0];
+	a0->start->start = 1;
+	
+	// The empty regex leaves no fragment and only accepts the empty string
+	if (top == 1) {
+		a0->start->final = stack[0].nullable;
+		for (int j = 0; j < stack[0].last.len; j++)
+			a0->states[stack[0].last.items[j]]->final = 1;
+		free(pa.follow[0].items);
+		pa.follow[0] = stack[0].first;
+		free(stack[0].last.items);
+	} else {
+		a0->start->final = 1;
+	}
+	
+	// follow lists can repeat a position, e.g. for (a*)*
+	int *mark = calloc(pa.len, sizeof(int));
+	if (mark == NULL) {
+		fprintf(stderr, "Error allocating memory for position automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < pa.len; i++) {
+		struct PosList *list = &pa.follow[i];
+		for (int j = 0; j < list->len; j++) {
+			int p = list->items[j];
+			if (mark[p] == i + 1) continue;
+			mark[p] = i + 1;
+			for (char *sym = pa.symbols[p]; *sym != '\0'; sym++)
+				Transition_add(a0->states[i], Transition_create(*sym, a0->states[p], '\0', '\0', '\0'));
+		}
+		free(list->items);
+	}
+	
+	free(mark);
+	free(pa.symbols);
+	free(pa.follow);
+	free(stack);
+	RegexParts_destroy(&parts);
+	free(postfix);
+	return a0;
+}
+
+// Machine for a set of patterns: a new start state with an empty
+// transition into each pattern's machine, whose final states are tagged
+// with the pattern's index in regexes
+struct Automaton *regex_set_to_nfa(char **regexes, int num, int position)
+{
+	struct Automaton **parts = malloc(sizeof(struct Automaton *) * (num > 0 ? num : 1));
+	if (parts == NULL) {
+		fprintf(stderr, "Error allocating memory for pattern set\n");
+		exit(EXIT_FAILURE);
+	}
+	int len = 1;
+	for (int i = 0; i < num; i++) {
+		parts[i] = position ? regex_to_glushkov(regexes[i]) : regex_to_nfa(regexes[i]);
+		len += parts[i]->len;
+	}
+	
+	struct Automaton *a0 = Automaton_create();
+	a0->max_len = len;
+	a0->states = realloc(a0->states, sizeof(struct State *) * a0->max_len);
+	if (a0->states == NULL) {
+		fprintf(stderr, "Error allocating memory for states array in automaton\n");
+		exit(EXIT_FAILURE);
+	}
+	struct State *start = State_create("q0");
+	start->start = 1;
+	a0->states[a0->len++] = start;
+	a0->start = start;
+	for (int i = 0; i < num; i++) {
+		Transition_add(start, Transition_create('\0', parts[i]->start, '\0', '\0', '\0'));
+		for (int j = 0; j < parts[i]->len; j++) {
+			struct State *state = parts[i]->states[j];
+			char name[STATE_NAME_MAX];
+			snprintf(name, STATE_NAME_MAX, "q%d", a0->len);
+			free(state->name);
+			state->name = strdup(name);
+			state->start = 0;
+			if (state->final) State_tag(state, i);
+			a0->states[a0->len++] = state;
+		}
+		Automaton_clear(parts[i]);
+	}
+	free(parts);
+	return a0;
+}
+
+static char *lit_repeat(char *s, int times)
+{
+	size_t len = strlen(s);
+	char *r = malloc(len * times + 1);
+	if (r == NULL) {
+		fprintf(stderr, "Error allocating memory for regex literal\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < times; i++) memcpy(r + i * len, s, len);
+	r[len * times] = '\0';
+	return r;
+}
+
+// The longest literal found that every match of the regex contains, for
+// skipping input that can't match. It is empty when nothing is required,
+// e.g. for a union of different words
+char *regex_literal(char *regex)
+{
+	struct RegexParts parts;
+	char *postfix = regex_postfix(regex, &parts);
+	int len = strlen(postfix);
+	struct LitFrag *stack = malloc(sizeof(struct LitFrag) * (len > 0 ? len : 1));
+	if (stack == NULL) {
+		fprintf(stderr, "Error allocating memory for regex literal\n");
+		exit(EXIT_FAILURE);
+	}
+	
+	int num_classes = 0;
+	int num_repeats = 0;
+	int top = 0;
+	for (int i = 0; i < len; i++) {
+		char c = postfix[i];
+		if (isalnum(c) || c == REGEX_CLASS) {
+			char sym[2] = { c, '\0' };
+			if (c == REGEX_CLASS) {
+				char *symbols = parts.classes[num_classes++];
+				sym[0] = strlen(symbols) == 1 ? symbols[0] : '\0';
+			}
+			stack[top].exact = sym[0] ? strdup(sym) : NULL;
+			stack[top++].must = strdup(sym);
+			continue;
+		}
+		struct LitFrag *a = &stack[top-1];
+		if (c == '*' || c == '?' || c == '+') {
+			if (c != '+') a->must[0] = '\0';
+			free(a->exact);
+			a->exact = NULL;
+		} else if (c == '{') {
+			int min = parts.min[num_repeats];
+			int max = parts.max[num_repeats++];
+			int repeated = min > 0 && a->exact && strlen(a->exact) * min <= REGEX_REPEAT_MAX;
+			if (min == 0) {
+				a->must[0] = '\0';
+			} else if (repeated) {
+				free(a->must);
+				a->must = lit_repeat(a->exact, min);
+			}
+			free(a->exact);
+			a->exact = (repeated && min == max) ? strdup(a->must) : NULL;
+		} else if (c == '|' || c == '_') {
+			a = &stack[top-2];
+			struct LitFrag *b = &stack[top-1];
+			if (c == '|') {
+				if (a->exact && (b->exact == NULL || strcmp(a->exact, b->exact) != 0)) {
+					free(a->exact);
+					a->exact = NULL;
+				}
+				if (strcmp(a->must, b->must) != 0) a->must[0] = '\0';
+			} else if (a->exact && b->exact) {
+				char *exact = word_join(a->exact, b->exact);
+				free(a->exact);
+				free(a->must);
+				a->exact = exact;
+				a->must = strdup(exact);
+			} else {
+				free(a->exact);
+				a->exact = NULL;
+				if (strlen(b->must) > strlen(a->must)) {
+					free(a->must);
+					a->must = b->must;
+					b->must = NULL;
+				}
+			}
+			free(b->exact);
+			free(b->must);
+			top--;
+		}
+	}
+	
+	// The empty regex leaves no fragment
+	char *literal = top == 1 ? stack[0].must : strdup("");
+	if (top == 1) free(stack[0].exact);
+	free(stack);
+	RegexParts_destroy(&parts);
+	free(postfix);
+	return literal;
+}
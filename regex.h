@@ -1,6 +1,15 @@
 #ifndef REGEX_H_
 #define REGEX_H_
 
+// Alternations of at least this many literal words are built as a trie
+#define REGEX_TRIE_MIN 16
+
+// Placeholder for a character class in a lexed regex
+#define REGEX_CLASS '['
+
+// Largest bound of a {m,n} repeat
+#define REGEX_REPEAT_MAX 1000
+
 struct CharNode {
 	char value;
 	struct CharNode *next;
@@ -11,14 +20,76 @@ struct CharStack {
 	struct CharNode *top;
 };
 
-struct AutoNode {
-	struct Automaton *automaton;
-	struct AutoNode *next;
+// Character classes and repeat bounds lexed out of a regex, in the order
+// their placeholders appear in the postfix form. Each class is its member
+// symbols, and a max of -1 is unbounded
+struct RegexParts {
+	int num_classes;
+	int max_classes;
+	char **classes;
+	int num_repeats;
+	int max_repeats;
+	int *min;
+	int *max;
+};
+
+// States of a Thompson NFA under construction. Each fragment chains its
+// states in output order through next, and its final states through
+// next_final, so joining fragments never copies or renames states.
+struct NFABuilder {
+	int len;
+	int max_len;
+	struct State **states;
+	int *next;
+	int *next_final;
+};
+
+struct NFAFrag {
+	int start;
+	int head;
+	int tail;
+	int final_head;
+	int final_tail;
+};
+
+// Literal words of an alternation, while collecting them for a trie
+struct WordList {
+	int len;
+	int max_len;
+	char **words;
+};
+
+// What regex_literal knows about a subexpression: exact is the only
+// string it matches, or NULL, and every match contains must
+struct LitFrag {
+	char *exact;
+	char *must;
+};
+
+// Growable list of regex positions
+struct PosList {
+	int len;
+	int max_len;
+	int *items;
+};
+
+// Nullable flag and first and last positions of a subexpression, for the
+// position (Glushkov) automaton. Its positions run from lo to the newest
+struct PosFrag {
+	int nullable;
+	int lo;
+	struct PosList first;
+	struct PosList last;
 };
 
-struct AutoStack {
+// Positions of a position automaton under construction: the symbols
+// each one matches, and the positions that may follow it. Position 0 is
+// the start
+struct PosAutomaton {
 	int len;
-	struct AutoNode *top;
+	int max_len;
+	char **symbols;
+	struct PosList *follow;
 };
 
 struct CharStack *CharStack_create();
@@ -30,18 +101,18 @@ void CharStack_destroy(struct CharStack *stack);
 void CharStack_print(struct CharStack *stack);
 void remove_spaces(char *s);
 char *infix(char *regex);
+void RegexParts_destroy(struct RegexParts *parts);
+char *regex_lex(char *regex, struct RegexParts *parts);
+char *regex_postfix(char *regex, struct RegexParts *parts);
 int is_valid_regex(char *regex);
 
 char *infix(char *regex);
-struct Automaton *Automaton_concat(struct Automaton *a0, struct Automaton *a1);
-struct Automaton *Automaton_union(struct Automaton *a0, struct Automaton *a1);
-struct Automaton *Automaton_star(struct Automaton *a0);
-struct Automaton *Automaton_plus(struct Automaton *a0);
-struct Automaton *Automaton_char(char symbol);
-struct AutoStack *AutoStack_create();
-struct AutoNode *AutoNode_create(struct Automaton *a0);
-void AutoStack_push(struct AutoStack *stack, struct Automaton *a0);
-struct Automaton *AutoStack_pop(struct AutoStack *stack);
-void AutoStack_destroy(struct AutoStack *stack);
 struct Automaton *regex_to_nfa(char *regex);
+void PosList_add(struct PosList *list, int pos);
+void PosList_append(struct PosList *list, struct PosList *other);
+struct Automaton *regex_to_glushkov(char *regex);
+void WordList_add(struct WordList *list, char *word);
+void WordList_read(struct WordList *list, char *filename);
+struct Automaton *regex_set_to_nfa(char **regexes, int num, int position);
+char *regex_literal(char *regex);
 #endif // REGEX_H_
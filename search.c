@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auto.h"
+#include "ops.h"
+#include "dfa.h"
+#include "sink.h"
+#include "search.h"
+
+struct Search *Search_create(struct Automaton *automaton, char *literal)
+{
+	struct Search *search = malloc(sizeof(struct Search));
+	if (search == NULL) {
+		fprintf(stderr, "Error allocating memory for Search\n");
+		exit(EXIT_FAILURE);
+	}
+	int machine_code = isDFA(automaton);
+	if (machine_code > 1) {
+		fprintf(stderr, "Only a regex, NFA, or DFA can be searched with -G\n");
+		exit(EXIT_FAILURE);
+	}
+	search->dfa = NULL;
+	if (machine_code == 1 || isPartialDFA(automaton)) {
+		if (automaton->table == NULL)
+			automaton->table = DFATable_create(automaton);
+		search->table = automaton->table;
+	} else {
+		search->dfa = nfa_to_dfa(automaton);
+		if (search->dfa->table == NULL)
+			search->dfa->table = DFATable_create(search->dfa);
+		search->table = search->dfa->table;
+	}
+
+	// Records are lines, so a literal spanning lines can't be required
+	search->literal = NULL;
+	search->literal_len = 0;
+	if (literal != NULL && literal[0] != '\0' && strchr(literal, '\n') == NULL) {
+		search->literal = strdup(literal);
+		search->literal_len = strlen(literal);
+	}
+
+	struct DFATable *table = search->table;
+	int start = table->start;
+	search->nullable = start >= 0 && table->final[start];
+	search->first_byte = -1;
+	int num_first = 0;
+	for (int c = 0; c < 256; c++) {
+		int cls = table->classmap[c];
+		if (start < 0 || cls == 0)
+			search->first[c] = 0;
+		else if (start >= table->live)
+			search->first[c] = 1;
+		else
+			search->first[c] = table->next[start * table->nclasses + cls] >= 0;
+		if (search->first[c]) {
+			search->first_byte = c;
+			num_first++;
+		}
+	}
+	if (num_first != 1) search->first_byte = -1;
+
+	search->lineno = 0;
+	search->num_spans = 0;
+	search->max_spans = 8;
+	search->spans = malloc(sizeof(size_t) * 2 * search->max_spans);
+	if (search->spans == NULL) {
+		fprintf(stderr, "Error allocating memory for Search\n");
+		exit(EXIT_FAILURE);
+	}
+	return search;
+}
+
+void Search_destroy(struct Search *search)
+{
+	if (search->dfa != NULL) Automaton_destroy(search->dfa);
+	free(search->literal);
+	free(search->spans);
+	free(search);
+}
+
+// End of the longest nonempty match starting at line[from], or 0
+static size_t Search_longest(struct DFATable *table, const unsigned char *line,
+	size_t len, size_t from)
+{
+	const int *next = table->next;
+	const unsigned char *classmap = table->classmap;
+	const int nclasses = table->nclasses;
+	const int live = table->live;
+	int state = table->start;
+	size_t last = 0;
+	size_t i = from;
+	while (i < len) {
+		// Accepting sinks keep accepting until a byte outside the alphabet
+		if (state >= live) {
+			while (i < len && classmap[line[i]] != 0) i++;
+			return i;
+		}
+		state = next[state * nclasses + classmap[line[i++]]];
+		if (state < 0) break;
+		if (table->final[state]) last = i;
+	}
+	if (state >= live) last = i;
+	return last;
+}
+
+// Leftmost longest nonempty match in line at from or later. Returns 1 and
+// sets start and end (one past the match) if there is one
+int Search_match(struct Search *search, char *line, size_t len, size_t from,
+	size_t *start, size_t *end)
+{
+	const unsigned char *s = (const unsigned char *)line;
+	for (size_t i = from; i < len; i++) {
+		if (search->first_byte >= 0) {
+			const unsigned char *p = memchr(s + i, search->first_byte, len - i);
+			if (p == NULL) return 0;
+			i = p - s;
+		} else if (!search->first[s[i]]) {
+			continue;
+		}
+		size_t last = Search_longest(search->table, s, len, i);
+		if (last > i) {
+			*start = i;
+			*end = last;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Search one line and write its result. Every match is listed only for
+// the full output mode; the others just need to know there is one
+void Search_record(struct Search *search, char *record, size_t len)
+{
+	search->lineno++;
+	if (len > 0 && record[len-1] == '\r') len--;
+	search->num_spans = 0;
+	size_t from = 0;
+	size_t start, end;
+	while (Search_match(search, record, len, from, &start, &end)) {
+		if (search->num_spans == search->max_spans) {
+			search->max_spans *= 2;
+			search->spans = realloc(search->spans, sizeof(size_t) * 2 * search->max_spans);
+			if (search->spans == NULL) {
+				fprintf(stderr, "Error reallocating memory for Search\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		search->spans[2 * search->num_spans] = start;
+		search->spans[2 * search->num_spans + 1] = end;
+		search->num_spans++;
+		if (result_sink.mode != OUTPUT_FULL) break;
+		from = end;
+	}
+	Sink_matches(&result_sink, search->lineno, record, len, search->spans,
+		search->num_spans, search->num_spans > 0 || search->nullable);
+}
+
+// Offset of the next occurrence of the literal in buf[from..len), or len
+static size_t Search_find(struct Search *search, char *buf, size_t from, size_t len)
+{
+	const char *literal = search->literal;
+	size_t n = search->literal_len;
+	while (from + n <= len) {
+		char *p = memchr(buf + from, literal[0], len - n + 1 - from);
+		if (p == NULL) break;
+		if (memcmp(p + 1, literal + 1, n - 1) == 0) return p - buf;
+		from = p - buf + 1;
+	}
+	return len;
+}
+
+// Search every complete line in buf, like Automaton_run_records. Only
+// lines holding the next occurrence of the literal are run
+size_t Search_records(struct Search *search, char *buf, size_t len, int eof)
+{
+	size_t hit = 0;
+	int found = 0;
+	size_t pos = 0;
+	while (pos < len) {
+		char *nl = memchr(buf + pos, '\n', len - pos);
+		if (nl == NULL && !eof) break;
+		size_t rec_end = nl ? (size_t)(nl - buf) : len;
+		if (search->literal_len > 0) {
+			if (!found || hit < pos) {
+				hit = Search_find(search, buf, pos, len);
+				found = 1;
+			}
+			if (hit + search->literal_len > rec_end) {
+				search->lineno++;
+				size_t rec_len = rec_end - pos;
+				if (rec_len > 0 && buf[rec_end-1] == '\r') rec_len--;
+				Sink_matches(&result_sink, search->lineno, buf + pos, rec_len, NULL, 0, 0);
+				pos = nl ? rec_end + 1 : len;
+				continue;
+			}
+		}
+		Search_record(search, buf + pos, rec_end - pos);
+		pos = nl ? rec_end + 1 : len;
+	}
+	return pos;
+}
@@ -0,0 +1,28 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+// Unanchored matcher for -G. The machine runs as a DFA from each position
+// that can begin a match, for the leftmost longest match there. A line
+// without the literal that every match contains is rejected without
+// running the machine at all.
+struct Search {
+	struct Automaton *dfa;   // DFA built for the search, for an NFA
+	struct DFATable *table;
+	char *literal;
+	size_t literal_len;
+	char first[256];         // bytes that can begin a nonempty match
+	int first_byte;          // the only such byte, or -1
+	int nullable;
+	long lineno;
+	int num_spans;
+	int max_spans;
+	size_t *spans;           // start and end of each match in the line
+};
+
+struct Search *Search_create(struct Automaton *automaton, char *literal);
+void Search_destroy(struct Search *search);
+int Search_match(struct Search *search, char *line, size_t len, size_t from,
+	size_t *start, size_t *end);
+void Search_record(struct Search *search, char *record, size_t len);
+size_t Search_records(struct Search *search, char *buf, size_t len, int eof);
+#endif // SEARCH_H_
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auto.h"
+#include "sink.h"
+
+struct Sink result_sink;
+
+int Sink_mode(char *name)
+{
+	if (!strcmp(name, "full")) return OUTPUT_FULL;
+	if (!strcmp(name, "bit")) return OUTPUT_BIT;
+	if (!strcmp(name, "accepted")) return OUTPUT_ACCEPTED;
+	if (!strcmp(name, "rejected")) return OUTPUT_REJECTED;
+	if (!strcmp(name, "count")) return OUTPUT_COUNT;
+	return -1;
+}
+
+void Sink_init(struct Sink *sink, int mode, FILE *fp)
+{
+	sink->mode = mode;
+	sink->accepted = 0;
+	sink->rejected = 0;
+	sink->limited = 0;
+	sink->len = 0;
+	sink->max_len = SINK_BUFFER;
+	sink->fp = fp;
+	sink->buf = malloc(sizeof(char) * sink->max_len);
+	if (sink->buf == NULL) {
+		fprintf(stderr, "Error allocating memory for Sink buffer\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void Sink_flush(struct Sink *sink)
+{
+	if (sink->fp == NULL || sink->len == 0) return;
+	fwrite(sink->buf, 1, sink->len, sink->fp);
+	sink->len = 0;
+}
+
+void Sink_write(struct Sink *sink, char *s, size_t len)
+{
+	if (sink->len + len > sink->max_len) {
+		if (sink->fp != NULL) {
+			Sink_flush(sink);
+			if (len > sink->max_len) {
+				fwrite(s, 1, len, sink->fp);
+				return;
+			}
+		} else {
+			while (sink->len + len > sink->max_len) sink->max_len *= 2;
+			sink->buf = realloc(sink->buf, sizeof(char) * sink->max_len);
+			if (sink->buf == NULL) {
+				fprintf(stderr, "Error reallocating memory for Sink buffer\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	memcpy(sink->buf + sink->len, s, len);
+	sink->len += len;
+}
+
+// Result of one run. accepted may be VERDICT_LIMIT, which the accepted
+// and rejected modes leave out
+void Sink_result(struct Sink *sink, char *input, size_t len, int accepted)
+{
+	if (accepted == VERDICT_LIMIT) sink->limited++;
+	else if (accepted) sink->accepted++;
+	else sink->rejected++;
+	
+	switch (sink->mode) {
+		case OUTPUT_FULL:
+			Sink_write(sink, "=>", 2);
+			Sink_write(sink, input, len);
+			if (accepted == VERDICT_LIMIT) Sink_write(sink, "\n\tLIMIT\n", 8);
+			else if (accepted) Sink_write(sink, "\n\tACCEPTED\n", 11);
+			else Sink_write(sink, "\n\tREJECTED\n", 11);
+			break;
+		case OUTPUT_BIT:
+			if (accepted == VERDICT_LIMIT) Sink_write(sink, "L", 1);
+			else Sink_write(sink, accepted ? "1" : "0", 1);
+			break;
+		case OUTPUT_ACCEPTED:
+		case OUTPUT_REJECTED:
+			if (accepted == (sink->mode == OUTPUT_ACCEPTED)) {
+				Sink_write(sink, input, len);
+				Sink_write(sink, "\n", 1);
+			}
+			break;
+	}
+	
+	// Keep results in step with verbose traces and command output
+	if (flag_verbose || execute || delay) {
+		Sink_flush(sink);
+		if (sink->fp != NULL) fflush(sink->fp);
+	}
+}
+
+// Result for a DFA run that ended in state, or died if it is NULL. The
+// full mode lists the patterns accepted after ACCEPTED, for a pattern set
+void Sink_state(struct Sink *sink, char *input, size_t len, struct State *state)
+{
+	if (sink->mode != OUTPUT_FULL || state == NULL || !state->final || state->num_tags == 0) {
+		Sink_result(sink, input, len, state != NULL && state->final);
+		return;
+	}
+	sink->accepted++;
+	Sink_write(sink, "=>", 2);
+	Sink_write(sink, input, len);
+	Sink_write(sink, "\n\tACCEPTED", 10);
+	char num[16];
+	for (int i = 0; i < state->num_tags; i++) {
+		int n = snprintf(num, sizeof(num), " %d", state->tags[i]);
+		Sink_write(sink, num, n);
+	}
+	Sink_write(sink, "\n", 1);
+	if (flag_verbose || execute || delay) {
+		Sink_flush(sink);
+		if (sink->fp != NULL) fflush(sink->fp);
+	}
+}
+
+// Search result for one line. The full mode writes the line number, the
+// start and end offsets of each match, and the line, for matching lines
+// only; the other modes treat a matching line as accepted
+void Sink_matches(struct Sink *sink, long lineno, char *input, size_t len,
+	size_t *spans, int num_spans, int matched)
+{
+	if (sink->mode != OUTPUT_FULL) {
+		Sink_result(sink, input, len, matched);
+		return;
+	}
+	if (!matched) {
+		sink->rejected++;
+		return;
+	}
+	sink->accepted++;
+	char num[64];
+	int n = snprintf(num, sizeof(num), "%ld:", lineno);
+	Sink_write(sink, num, n);
+	if (num_spans == 0) Sink_write(sink, "0-0", 3);
+	for (int i = 0; i < num_spans; i++) {
+		n = snprintf(num, sizeof(num), "%s%zu-%zu", i ? "," : "", spans[2*i], spans[2*i+1]);
+		Sink_write(sink, num, n);
+	}
+	Sink_write(sink, ":", 1);
+	Sink_write(sink, input, len);
+	Sink_write(sink, "\n", 1);
+}
+
+// Move everything buffered in other, and its counts, into sink
+void Sink_append(struct Sink *sink, struct Sink *other)
+{
+	Sink_write(sink, other->buf, other->len);
+	sink->accepted += other->accepted;
+	sink->rejected += other->rejected;
+	sink->limited += other->limited;
+	other->len = 0;
+	other->accepted = 0;
+	other->rejected = 0;
+	other->limited = 0;
+}
+
+void Sink_finish(struct Sink *sink)
+{
+	if (sink->mode == OUTPUT_BIT && sink->accepted + sink->rejected + sink->limited > 0) {
+		Sink_write(sink, "\n", 1);
+	} else if (sink->mode == OUTPUT_COUNT) {
+		char counts[96];
+		int n = snprintf(counts, sizeof(counts), "ACCEPTED: %ld\nREJECTED: %ld\n",
+			sink->accepted, sink->rejected);
+		Sink_write(sink, counts, n);
+		// Only runs with a budget can have any
+		if (sink->limited > 0) {
+			n = snprintf(counts, sizeof(counts), "LIMIT: %ld\n", sink->limited);
+			Sink_write(sink, counts, n);
+		}
+	}
+	Sink_flush(sink);
+	if (sink->fp != NULL) fflush(sink->fp);
+}
+
+void Sink_destroy(struct Sink *sink)
+{
+	free(sink->buf);
+	sink->buf = NULL;
+}
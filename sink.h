@@ -0,0 +1,39 @@
+#ifndef SINK_H_
+#define SINK_H_
+
+#define SINK_BUFFER (1 << 16)
+
+// Result output modes
+#define OUTPUT_FULL 0      // =>input and ACCEPTED/REJECTED/LIMIT (default)
+#define OUTPUT_BIT 1       // one '1', '0' or 'L' byte per input
+#define OUTPUT_ACCEPTED 2  // accepted inputs only, one per line
+#define OUTPUT_REJECTED 3  // rejected inputs only, one per line
+#define OUTPUT_COUNT 4     // only the totals of accepted and rejected inputs
+
+// Buffered result writer. A sink with a FILE is flushed to it whenever
+// the buffer fills; a sink without one grows until appended elsewhere
+struct Sink {
+	int mode;
+	long accepted;
+	long rejected;
+	long limited;
+	size_t len;
+	size_t max_len;
+	char *buf;
+	FILE *fp;
+};
+
+extern struct Sink result_sink;
+
+int Sink_mode(char *name);
+void Sink_init(struct Sink *sink, int mode, FILE *fp);
+void Sink_write(struct Sink *sink, char *s, size_t len);
+void Sink_result(struct Sink *sink, char *input, size_t len, int accepted);
+void Sink_state(struct Sink *sink, char *input, size_t len, struct State *state);
+void Sink_matches(struct Sink *sink, long lineno, char *input, size_t len,
+	size_t *spans, int num_spans, int matched);
+void Sink_append(struct Sink *sink, struct Sink *other);
+void Sink_flush(struct Sink *sink);
+void Sink_finish(struct Sink *sink);
+void Sink_destroy(struct Sink *sink);
+#endif // SINK_H_
@@ -14,6 +14,7 @@ struct Stack *Stack_create()
 	stack->len = 0;
 	stack->max_len = 2;
 	stack->pos = 0;
+	stack->hash = 0;
 	stack->stack = malloc(sizeof(char ) * (stack->max_len+1)); // Allow null terminator
 	if (stack->stack == NULL) {
 		fprintf(stderr, "Error allocating memory for string in Stack struct\n");
@@ -24,6 +25,28 @@ struct Stack *Stack_create()
 	
 }
 
+// STACK_HASH_BASE^n
+static unsigned long long Stack_hash_pow(int n)
+{
+	unsigned long long base = STACK_HASH_BASE;
+	unsigned long long pow = 1;
+	while (n > 0) {
+		if (n & 1) pow *= base;
+		base *= base;
+		n >>= 1;
+	}
+	return pow;
+}
+
+// Put symbol at stack[i], which is within the buffer, updating the hash
+static void Stack_set(struct Stack *stack, int i, char symbol)
+{
+	unsigned long long pow = Stack_hash_pow(i);
+	stack->hash += (unsigned long long)(unsigned char)symbol * pow;
+	stack->hash -= (unsigned long long)(unsigned char)stack->stack[i] * pow;
+	stack->stack[i] = symbol;
+}
+
 void Stack_push(struct Stack *stack, char symbol)
 {
 	stack->len++;
@@ -35,7 +58,7 @@ void Stack_push(struct Stack *stack, char symbol)
 			exit(EXIT_FAILURE);
 		}
 	}
-	stack->stack[stack->len-1] = symbol;
+	Stack_set(stack, stack->len-1, symbol);
 	stack->stack[stack->len] = '\0';
 }
 
@@ -52,6 +75,14 @@ int Stack_change_pos(struct Stack *stack, char direction)
 			}
 			memmove(stack->stack+stack->max_len, stack->stack, stack->max_len+1);
 			memset(stack->stack, tm_blank, stack->max_len);
+			// Everything moves up by max_len, under that many blanks
+			unsigned long long blanks = 0;
+			unsigned long long pow = 1;
+			for (int i = 0; i < stack->max_len; i++) {
+				blanks += (unsigned long long)(unsigned char)tm_blank * pow;
+				pow *= STACK_HASH_BASE;
+			}
+			stack->hash = stack->hash * pow + blanks;
 			stack->len = stack->len + stack->max_len;
 			stack->pos = stack->max_len-1;
 			stack->max_len *= 2;
@@ -79,7 +110,7 @@ char Stack_pop(struct Stack *stack)
 {
 	if (stack->len == 0) return '\0';
 	char symbol = stack->stack[stack->len-1];
-	stack->stack[stack->len-1] = '\0';
+	Stack_set(stack, stack->len-1, '\0');
 	stack->len--;
 	return symbol;
 }
@@ -90,10 +121,17 @@ char Stack_peek(struct Stack *stack)
 	else return stack->stack[stack->len-1];
 }
 
+// Overwrite the symbol under a TM head
+void Stack_write(struct Stack *stack, char symbol)
+{
+	Stack_set(stack, stack->pos, symbol);
+}
+
 struct Stack *Stack_copy(struct Stack *stack)
 {
 	struct Stack *new_stack = Stack_create();
 	new_stack->pos = stack->pos;
+	new_stack->hash = stack->hash;
 	new_stack->len = stack->len;
 	new_stack->max_len = stack->max_len;
 	new_stack->stack = realloc(new_stack->stack, sizeof (char) * (new_stack->max_len+1));
@@ -117,25 +155,64 @@ struct MultiStack *MultiStack_create(struct State *state)
 	ms0->len = 0;
 	ms0->max_len = 2;
 	ms0->stacks = malloc(sizeof(struct Stack *) * ms0->max_len);
-	if (ms0->stacks == NULL) {
+	ms0->num_slots = 4;
+	ms0->slots = malloc(sizeof(int) * ms0->num_slots);
+	if (ms0->stacks == NULL || ms0->slots == NULL) {
 		fprintf(stderr, "Error allocating memory for Stack array in MultiStack\n");
 		exit(EXIT_FAILURE);
 	}
+	memset(ms0->slots, -1, sizeof(int) * ms0->num_slots);
 	
 	return ms0;
 }
 
 int Stack_equiv(struct Stack *st0, struct Stack *st1)
 {
-	if (strcmp(st0->stack, st1->stack) == 0 && st0->pos == st1->pos) {
-		return 1;
-	} else return 0;
+	if (st0->hash != st1->hash || st0->len != st1->len || st0->pos != st1->pos)
+		return 0;
+	// A head just past the end may have written there
+	int len = st0->pos >= st0->len ? st0->pos + 1 : st0->len;
+	return memcmp(st0->stack, st1->stack, len) == 0;
 }
 
-void Stack_add(struct MultiStack *ms0, struct Stack *stack)
+static unsigned Stack_hash(struct Stack *stack)
 {
-	for (int i = 0; i < ms0->len; i++) {
-		if (Stack_equiv(ms0->stacks[i], stack)) return;
+	unsigned long long hash = (stack->hash ^ (unsigned)stack->pos) * 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(hash >> 32);
+}
+
+// Slot of stack in the index of ms0, or the empty slot where it goes
+static int MultiStack_slot(struct MultiStack *ms0, struct Stack *stack)
+{
+	int mask = ms0->num_slots - 1;
+	int i = Stack_hash(stack) & mask;
+	while (ms0->slots[i] != -1) {
+		if (Stack_equiv(ms0->stacks[ms0->slots[i]], stack)) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// Add stack unless ms0 already has an equal one, in which case stack is
+// destroyed. Returns 1 if added
+int Stack_add(struct MultiStack *ms0, struct Stack *stack)
+{
+	if ((ms0->len + 1) * 2 > ms0->num_slots) {
+		ms0->num_slots *= 2;
+		ms0->slots = realloc(ms0->slots, sizeof(int) * ms0->num_slots);
+		if (ms0->slots == NULL) {
+			fprintf(stderr, "Error reallocating memory for Stack index in MultiStack\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(ms0->slots, -1, sizeof(int) * ms0->num_slots);
+		for (int i = 0; i < ms0->len; i++) {
+			ms0->slots[MultiStack_slot(ms0, ms0->stacks[i])] = i;
+		}
+	}
+	int slot = MultiStack_slot(ms0, stack);
+	if (ms0->slots[slot] != -1) {
+		Stack_destroy(stack);
+		return 0;
 	}
 	ms0->len++;
 	if (ms0->len > ms0->max_len) {
@@ -147,6 +224,8 @@ void Stack_add(struct MultiStack *ms0, struct Stack *stack)
 		}
 	}
 	ms0->stacks[ms0->len-1] = stack;
+	ms0->slots[slot] = ms0->len-1;
+	return 1;
 }
 
 
@@ -161,10 +240,13 @@ struct MultiStackList *MultiStackList_create()
 	msl0->len = 0;
 	msl0->max_len = 2;
 	msl0->mstacks = malloc(sizeof(struct MultiStack *) * msl0->max_len);
-	if (msl0->mstacks == NULL) {
+	msl0->num_slots = 4;
+	msl0->slots = malloc(sizeof(int) * msl0->num_slots);
+	if (msl0->mstacks == NULL || msl0->slots == NULL) {
 		fprintf(stderr, "Error allocating memory for MultiStack array in MultiStackList\n");
 		exit(EXIT_FAILURE);
 	}
+	memset(msl0->slots, -1, sizeof(int) * msl0->num_slots);
 	
 	return msl0;
 }
@@ -181,6 +263,7 @@ void MultiStack_destroy(struct MultiStack *ms0)
 		Stack_destroy(ms0->stacks[i]);
 	}
 	free(ms0->stacks);
+	free(ms0->slots);
 	free(ms0);
 }
 
@@ -190,6 +273,7 @@ void MultiStackList_destroy(struct MultiStackList *msl0)
 		MultiStack_destroy(msl0->mstacks[i]);
 	}
 	free(msl0->mstacks);
+	free(msl0->slots);
 	free(msl0);
 }
 
@@ -231,17 +315,47 @@ void MultiStackList_print(struct MultiStackList *msl0)
 	}
 }
 
-struct MultiStack *MultiStack_get(struct MultiStackList *msl0, struct State *state)
+static unsigned MultiStack_hash(struct State *state)
 {
-	for (int i = 0; i < msl0->len; i++) {
-		if (msl0->mstacks[i]->state == state)
-			return msl0->mstacks[i];
+	unsigned long long hash = (unsigned long long)(size_t)state * 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(hash >> 32);
+}
+
+// Slot of the stacks of state in the index of msl0, or the empty slot
+// where they go
+static int MultiStackList_slot(struct MultiStackList *msl0, struct State *state)
+{
+	int mask = msl0->num_slots - 1;
+	int i = MultiStack_hash(state) & mask;
+	while (msl0->slots[i] != -1) {
+		if (msl0->mstacks[msl0->slots[i]]->state == state) break;
+		i = (i + 1) & mask;
 	}
-	return NULL;
+	return i;
+}
+
+struct MultiStack *MultiStack_get(struct MultiStackList *msl0, struct State *state)
+{
+	int slot = MultiStackList_slot(msl0, state);
+	if (msl0->slots[slot] == -1) return NULL;
+	return msl0->mstacks[msl0->slots[slot]];
 }
 
 void MultiStack_add(struct MultiStackList *msl0, struct MultiStack *ms0)
 {
+	if ((msl0->len + 1) * 2 > msl0->num_slots) {
+		msl0->num_slots *= 2;
+		msl0->slots = realloc(msl0->slots, sizeof(int) * msl0->num_slots);
+		if (msl0->slots == NULL) {
+			fprintf(stderr, "Error reallocating memory for MultiStack index in MultiStackList\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(msl0->slots, -1, sizeof(int) * msl0->num_slots);
+		for (int i = 0; i < msl0->len; i++) {
+			msl0->slots[MultiStackList_slot(msl0, msl0->mstacks[i]->state)] = i;
+		}
+	}
+	msl0->slots[MultiStackList_slot(msl0, ms0->state)] = msl0->len;
 	msl0->len++;
 	if (msl0->len > msl0->max_len) {
 		msl0->max_len *= 2;
@@ -254,7 +368,21 @@ void MultiStack_add(struct MultiStackList *msl0, struct MultiStack *ms0)
 	msl0->mstacks[msl0->len-1] = ms0;
 }
 
-void Stack_add_to(struct MultiStackList *msl0, struct State *s0, struct Stack *stack)
+// Number of stacks in msl0, and the length of the longest in *max_len
+long MultiStackList_count(struct MultiStackList *msl0, int *max_len)
+{
+	long count = 0;
+	*max_len = 0;
+	for (int i = 0; i < msl0->len; i++) {
+		struct MultiStack *ms0 = msl0->mstacks[i];
+		count += ms0->len;
+		for (int j = 0; j < ms0->len; j++)
+			if (ms0->stacks[j]->len > *max_len) *max_len = ms0->stacks[j]->len;
+	}
+	return count;
+}
+
+int Stack_add_to(struct MultiStackList *msl0, struct State *s0, struct Stack *stack)
 {
 	struct MultiStack *ms0 = MultiStack_get(msl0, s0);
 	
@@ -262,7 +390,203 @@ void Stack_add_to(struct MultiStackList *msl0, struct State *s0, struct Stack *s
 		ms0 = MultiStack_create(s0);
 		MultiStack_add(msl0, ms0);
 	}
-	Stack_add(ms0, stack);
-	
-	
+	return Stack_add(ms0, stack);
+}
+
+#define STACK_BLOCK 4096
+
+struct StackGraph *StackGraph_create()
+{
+	struct StackGraph *graph = malloc(sizeof(struct StackGraph));
+	if (graph == NULL) {
+		fprintf(stderr, "Error allocating memory for StackGraph\n");
+		exit(EXIT_FAILURE);
+	}
+	graph->len = 0;
+	graph->num_buckets = 64;
+	graph->buckets = calloc(graph->num_buckets, sizeof(struct StackNode *));
+	if (graph->buckets == NULL) {
+		fprintf(stderr, "Error allocating memory for buckets in StackGraph\n");
+		exit(EXIT_FAILURE);
+	}
+	graph->num_blocks = 0;
+	graph->block_len = STACK_BLOCK;
+	graph->blocks = NULL;
+	return graph;
+}
+
+static unsigned StackNode_hash(struct StackNode *parent, char symbol)
+{
+	unsigned long long hash = (unsigned long long)(size_t)parent ^ (unsigned char)symbol;
+	hash *= 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(hash >> 32);
+}
+
+static void StackGraph_grow(struct StackGraph *graph)
+{
+	int num_buckets = graph->num_buckets * 2;
+	struct StackNode **buckets = calloc(num_buckets, sizeof(struct StackNode *));
+	if (buckets == NULL) {
+		fprintf(stderr, "Error reallocating memory for buckets in StackGraph\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < graph->num_buckets; i++) {
+		struct StackNode *node = graph->buckets[i];
+		while (node != NULL) {
+			struct StackNode *next = node->next;
+			unsigned b = StackNode_hash(node->parent, node->symbol) & (num_buckets - 1);
+			node->next = buckets[b];
+			buckets[b] = node;
+			node = next;
+		}
+	}
+	free(graph->buckets);
+	graph->buckets = buckets;
+	graph->num_buckets = num_buckets;
+}
+
+// The stack with symbol pushed onto stack
+struct StackNode *StackGraph_push(struct StackGraph *graph, struct StackNode *stack, char symbol)
+{
+	struct StackNode **bucket = &graph->buckets[StackNode_hash(stack, symbol) & (graph->num_buckets - 1)];
+	for (struct StackNode *node = *bucket; node != NULL; node = node->next) {
+		if (node->parent == stack && node->symbol == symbol) return node;
+	}
+	if (graph->block_len == STACK_BLOCK) {
+		graph->blocks = realloc(graph->blocks, sizeof(struct StackNode *) * (graph->num_blocks + 1));
+		if (graph->blocks == NULL) {
+			fprintf(stderr, "Error reallocating memory for blocks in StackGraph\n");
+			exit(EXIT_FAILURE);
+		}
+		graph->blocks[graph->num_blocks] = malloc(sizeof(struct StackNode) * STACK_BLOCK);
+		if (graph->blocks[graph->num_blocks] == NULL) {
+			fprintf(stderr, "Error allocating memory for nodes in StackGraph\n");
+			exit(EXIT_FAILURE);
+		}
+		graph->num_blocks++;
+		graph->block_len = 0;
+	}
+	struct StackNode *node = &graph->blocks[graph->num_blocks-1][graph->block_len++];
+	node->symbol = symbol;
+	node->depth = stack != NULL ? stack->depth + 1 : 1;
+	node->parent = stack;
+	node->next = *bucket;
+	*bucket = node;
+	if (++graph->len > graph->num_buckets) StackGraph_grow(graph);
+	return node;
+}
+
+void StackGraph_destroy(struct StackGraph *graph)
+{
+	for (int i = 0; i < graph->num_blocks; i++) {
+		free(graph->blocks[i]);
+	}
+	free(graph->blocks);
+	free(graph->buckets);
+	free(graph);
+}
+
+// Print the stack bottom first, like Stack_print
+void StackNode_print(struct StackNode *stack)
+{
+	if (stack == NULL) return;
+	char *buf = malloc(stack->depth + 1);
+	if (buf == NULL) {
+		fprintf(stderr, "Error allocating memory for printing a stack\n");
+		exit(EXIT_FAILURE);
+	}
+	buf[stack->depth] = '\0';
+	for (struct StackNode *node = stack; node != NULL; node = node->parent) {
+		buf[node->depth-1] = node->symbol;
+	}
+	fputs(buf, stdout);
+	free(buf);
+}
+
+struct ConfigSet *ConfigSet_create()
+{
+	struct ConfigSet *set = malloc(sizeof(struct ConfigSet));
+	if (set == NULL) {
+		fprintf(stderr, "Error allocating memory for ConfigSet\n");
+		exit(EXIT_FAILURE);
+	}
+	set->len = 0;
+	set->max_len = 8;
+	set->configs = malloc(sizeof(struct PDAConfig) * set->max_len);
+	set->num_slots = 16;
+	set->slots = malloc(sizeof(int) * set->num_slots);
+	if (set->configs == NULL || set->slots == NULL) {
+		fprintf(stderr, "Error allocating memory for ConfigSet\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(set->slots, -1, sizeof(int) * set->num_slots);
+	return set;
+}
+
+static unsigned PDAConfig_hash(struct State *state, struct StackNode *stack)
+{
+	unsigned long long hash = (unsigned long long)(size_t)state * 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (unsigned long long)(size_t)stack) * 0xC2B2AE3D27D4EB4FULL;
+	return (unsigned)(hash >> 32);
+}
+
+static int ConfigSet_slot(struct ConfigSet *set, struct State *state, struct StackNode *stack)
+{
+	int mask = set->num_slots - 1;
+	int i = PDAConfig_hash(state, stack) & mask;
+	while (set->slots[i] != -1) {
+		struct PDAConfig *config = &set->configs[set->slots[i]];
+		if (config->state == state && config->stack == stack) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// Add a configuration unless the set already has it. Returns 1 if added
+int ConfigSet_add(struct ConfigSet *set, struct State *state, struct StackNode *stack)
+{
+	if ((set->len + 1) * 2 > set->num_slots) {
+		set->num_slots *= 2;
+		set->slots = realloc(set->slots, sizeof(int) * set->num_slots);
+		if (set->slots == NULL) {
+			fprintf(stderr, "Error reallocating memory for ConfigSet\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(set->slots, -1, sizeof(int) * set->num_slots);
+		for (int i = 0; i < set->len; i++) {
+			struct PDAConfig *config = &set->configs[i];
+			config->slot = ConfigSet_slot(set, config->state, config->stack);
+			set->slots[config->slot] = i;
+		}
+	}
+	int slot = ConfigSet_slot(set, state, stack);
+	if (set->slots[slot] != -1) return 0;
+	if (set->len == set->max_len) {
+		set->max_len *= 2;
+		set->configs = realloc(set->configs, sizeof(struct PDAConfig) * set->max_len);
+		if (set->configs == NULL) {
+			fprintf(stderr, "Error reallocating memory for ConfigSet\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	set->configs[set->len].state = state;
+	set->configs[set->len].stack = stack;
+	set->configs[set->len].slot = slot;
+	set->slots[slot] = set->len++;
+	return 1;
+}
+
+void ConfigSet_clear(struct ConfigSet *set)
+{
+	for (int i = 0; i < set->len; i++) {
+		set->slots[set->configs[i].slot] = -1;
+	}
+	set->len = 0;
+}
+
+void ConfigSet_destroy(struct ConfigSet *set)
+{
+	free(set->configs);
+	free(set->slots);
+	free(set);
 }
@@ -1,24 +1,74 @@
 #ifndef STACK_H_
 #define STACK_H_
 
+#define STACK_HASH_BASE 1099511628211ULL
+
+// A PDA stack or TM tape. hash is the sum of stack[i] * STACK_HASH_BASE^i,
+// kept up to date by every change so equal contents are found in O(1)
 struct Stack {
 	int len;
 	int max_len;
 	int pos;
+	unsigned long long hash;
 	char *stack;
 };
 
+// The distinct stacks held in one state, with an open addressing index
+// of them by hash and head position
 struct MultiStack {
 	int len;
 	int max_len;
 	struct State *state;
 	struct Stack **stacks;
+	int num_slots;
+	int *slots;
 };
 
+// Configurations of one machine step, grouped by state and indexed by it
 struct MultiStackList {
 	int len;
 	int max_len;
 	struct MultiStack **mstacks;
+	int num_slots;
+	int *slots;
+};
+
+// Stacks of a nondeterministic PDA run. Each node is one symbol on top of
+// its parent, and a stack is its top node (NULL when empty). Nodes are
+// hash consed, so equal stacks are the same node, every branch shares
+// the prefix it has in common with the others, and a push either finds
+// or creates a single node. Nodes live until the graph is destroyed.
+struct StackNode {
+	char symbol;
+	int depth;
+	struct StackNode *parent;
+	struct StackNode *next;   // next node in the same hash bucket
+};
+
+struct StackGraph {
+	int len;
+	int num_buckets;
+	struct StackNode **buckets;
+	int num_blocks;
+	int block_len;            // nodes used in the newest block
+	struct StackNode **blocks;
+};
+
+// One configuration of a PDA run: a state and the stack it holds
+struct PDAConfig {
+	struct State *state;
+	struct StackNode *stack;
+	int slot;
+};
+
+// Configurations of one step, in the order they were added, with an
+// open addressing index of them so a duplicate is found in O(1)
+struct ConfigSet {
+	int len;
+	int max_len;
+	struct PDAConfig *configs;
+	int num_slots;
+	int *slots;
 };
 
 struct Stack *Stack_create();
@@ -26,9 +76,10 @@ void Stack_push(struct Stack *stack, char symbol);
 int Stack_change_pos(struct Stack *stack, char direction);
 char Stack_pop(struct Stack *stack);
 char Stack_peek(struct Stack *stack);
+void Stack_write(struct Stack *stack, char symbol);
 struct Stack *Stack_copy(struct Stack *stack);
 struct MultiStack *MultiStack_create(struct State *state);
-void Stack_add(struct MultiStack *ms0, struct Stack *stack);
+int Stack_add(struct MultiStack *ms0, struct Stack *stack);
 struct MultiStackList *MultiStackList_create();
 void Stack_destroy(struct Stack *stack);
 void MultiStack_destroy(struct MultiStack *ms0);
@@ -37,7 +88,17 @@ void Stack_print(struct Stack *stack);
 void MultiStack_print(struct MultiStack *ms0);
 void MultiStackList_print(struct MultiStackList *msl0);
 
+struct StackGraph *StackGraph_create();
+struct StackNode *StackGraph_push(struct StackGraph *graph, struct StackNode *stack, char symbol);
+void StackGraph_destroy(struct StackGraph *graph);
+void StackNode_print(struct StackNode *stack);
+struct ConfigSet *ConfigSet_create();
+int ConfigSet_add(struct ConfigSet *set, struct State *state, struct StackNode *stack);
+void ConfigSet_clear(struct ConfigSet *set);
+void ConfigSet_destroy(struct ConfigSet *set);
+
 struct MultiStack *MultiStack_get(struct MultiStackList *msl0, struct State *state);
 void MultiStack_add(struct MultiStackList *msl0, struct MultiStack *ms0);
-void Stack_add_to(struct MultiStackList *msl0, struct State *s0, struct Stack *stack);
+long MultiStackList_count(struct MultiStackList *msl0, int *max_len);
+int Stack_add_to(struct MultiStackList *msl0, struct State *s0, struct Stack *stack);
 #endif // STACK_H_
@@ -0,0 +1,197 @@
+#!/bin/sh
+# Regression checks: sh tests/check.sh [path to tmf]
+# Each check runs the same inputs down two paths that have to agree.
+# Building tmf with -fsanitize=address first also catches overruns:
+#   rm -f tmf && make check CFLAGS="-g -fsanitize=address -pthread"
+
+TMF=${1:-./tmf}
+SAMPLES=$(dirname "$0")/../samples
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+status=0
+
+same() {
+	if cmp -s "$2" "$3"; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1"
+		status=1
+	fi
+}
+
+# Binary strings of very different lengths, so the DFA lanes that run
+# records in lockstep finish at different times
+awk 'BEGIN {
+	srand(5);
+	n = split("5000 1 1 0 1 2 20000 1 3 1 1 0 7 1 900 1 1 1 1 1 1 1 1 1 1 1", lens, " ");
+	for (r = 0; r < 40; r++) {
+		for (k = 1; k <= n; k++) {
+			s = "";
+			for (i = 0; i < lens[k]; i++) s = s (rand() < 0.5 ? "0" : "1");
+			print s;
+		}
+	}
+}' > "$TMP/lanes.txt"
+
+"$TMF" "$SAMPLES/dfa_divBy8.txt" -f "$TMP/lanes.txt" > "$TMP/lanes_f.out"
+"$TMF" "$SAMPLES/dfa_divBy8.txt" -F "$TMP/lanes.txt" > "$TMP/lanes_F.out"
+same "DFA lanes, -F" "$TMP/lanes_f.out" "$TMP/lanes_F.out"
+cat "$TMP/lanes.txt" | "$TMF" "$SAMPLES/dfa_divBy8.txt" -F - > "$TMP/lanes_pipe.out"
+same "DFA lanes, -F -" "$TMP/lanes_f.out" "$TMP/lanes_pipe.out"
+
+# Enough short lines, some empty and some ending in \r, that -j splits
+# them over many chunks whose edges fall inside records
+awk 'BEGIN {
+	srand(11);
+	for (r = 0; r < 40000; r++) {
+		len = int(rand() * 17);
+		s = "";
+		for (i = 0; i < len; i++) s = s (rand() < 0.5 ? "0" : "1");
+		if (r % 97 == 5) s = s "\r";
+		print s;
+	}
+}' > "$TMP/batch.txt"
+
+# Each kind of machine on the worker pool, against the single-threaded run
+for machine in dfa_divBy8 nfa_endsThree0s pda_palindrome tm_evenPalindrome; do
+	"$TMF" "$SAMPLES/$machine.txt" -F "$TMP/batch.txt" > "$TMP/batch.out"
+	"$TMF" "$SAMPLES/$machine.txt" -j 4 -f "$TMP/batch.txt" > "$TMP/batch_j.out"
+	same "$machine, -j 4 -f" "$TMP/batch.out" "$TMP/batch_j.out"
+	"$TMF" "$SAMPLES/$machine.txt" -j 4 -F "$TMP/batch.txt" > "$TMP/batch_j.out"
+	same "$machine, -j 4 -F" "$TMP/batch.out" "$TMP/batch_j.out"
+done
+"$TMF" -r "(0|1)*1(0|1)(0|1)" -F "$TMP/batch.txt" > "$TMP/batch.out"
+"$TMF" -r "(0|1)*1(0|1)(0|1)" -j 4 -f "$TMP/batch.txt" > "$TMP/batch_j.out"
+same "regex, -j 4 -f" "$TMP/batch.out" "$TMP/batch_j.out"
+
+# Log lines for -G. A lone -r is searched only where its literal occurs,
+# while the same regex as a pattern set runs every line, so the set read
+# with -F is the reference. Some lines end in the literal and the next
+# starts with digits. Read from a pipe, records straddle blocks
+awk 'BEGIN {
+	srand(13);
+	split("GET POST PUT", method, " ");
+	for (r = 0; r < 30000; r++) {
+		s = method[int(rand() * 3) + 1] " /api/" int(rand() * 500);
+		if (rand() < 0.3) s = s " ERROR code=E" int(rand() * 100000);
+		if (rand() < 0.1) s = s " E12 E" int(rand() * 99999);
+		if (r % 53 == 7) s = s " E";
+		if (r % 53 == 8) s = "12345 " s;
+		if (r % 89 == 3) s = s "\r";
+		print s;
+	}
+}' > "$TMP/log.txt"
+echo 'E[0-9]{4}' > "$TMP/set.txt"
+
+"$TMF" -G -R "$TMP/set.txt" -F "$TMP/log.txt" > "$TMP/search.out"
+"$TMF" -G -r 'E[0-9]{4}' -F "$TMP/log.txt" > "$TMP/search_r.out"
+same "search, -r -F" "$TMP/search.out" "$TMP/search_r.out"
+cat "$TMP/log.txt" | "$TMF" -G -r 'E[0-9]{4}' -F - > "$TMP/search_r.out"
+same "search, -r -F -" "$TMP/search.out" "$TMP/search_r.out"
+"$TMF" -G -r 'E[0-9]{4}' -f "$TMP/log.txt" > "$TMP/search_r.out"
+same "search, -r -f" "$TMP/search.out" "$TMP/search_r.out"
+"$TMF" -G -r 'E[0-9]{4}' -j 4 -F "$TMP/log.txt" > "$TMP/search_r.out"
+same "search, -r -j 4 -F" "$TMP/search.out" "$TMP/search_r.out"
+
+# An image of a DFA with commands, args and a table, then copies of it
+# broken one field at a time. Offsets follow the layout in image.h, with
+# a 52 byte header, 40 byte states and 8 byte transitions
+printf 'start: q0;\nfinal: q0;\nq0:\n\t0>q0;\n\t1>q1;\n\t$(echo even);\nq1:\n\t0>q2;\n\t1>q0;\n\t$(echo odd one);\nq2:\n\t0>q1;\n\t1>q2;\n' > "$TMP/divBy3.txt"
+"$TMF" -b "$TMP/image.tmfi" "$TMP/divBy3.txt" -c > /dev/null
+field() {
+	od -An -t d4 -j "$1" -N 4 "$TMP/image.tmfi" | tr -d ' '
+}
+num_states=$(field 8)
+num_trans=$(field 12)
+num_args=$(field 16)
+num_tags=$(field 20)
+strings_len=$(field 24)
+args=$((52 + 40 * num_states + 8 * num_trans))
+pool=$((args + 4 * num_args + 4 * num_tags))
+table=$((pool + (strings_len + 3) / 4 * 4))
+next=$((table + 256 + (num_states + 3) / 4 * 4))
+
+# Write 1000 (or byte x) at each offset in turn, expecting a clean refusal
+for bad in "trans range:68" "arg range:100" "tag range:76" "name:52" "cmd:56" \
+	"arg string:$args" "pool end:$((pool + strings_len - 1)):x" "classmap:$((table + 48)):x" \
+	"next:$next" "table start:44" "table live:40" "state id:84" "truncated:$table:cut"; do
+	name=${bad%%:*}
+	rest=${bad#*:}
+	at=${rest%%:*}
+	cp "$TMP/image.tmfi" "$TMP/bad.tmfi"
+	case $rest in
+		*:cut) head -c "$at" "$TMP/image.tmfi" > "$TMP/bad.tmfi" ;;
+		*:x) printf '\377' | dd of="$TMP/bad.tmfi" bs=1 seek="$at" conv=notrunc 2> /dev/null ;;
+		*) printf '\350\003\000\000' | dd of="$TMP/bad.tmfi" bs=1 seek="$at" conv=notrunc 2> /dev/null ;;
+	esac
+	"$TMF" "$TMP/bad.tmfi" 1000 > /dev/null 2> "$TMP/bad.err"
+	echo "not a valid" > "$TMP/bad.want"
+	grep -o "not a valid" "$TMP/bad.err" > "$TMP/bad.got"
+	same "image, bad $name" "$TMP/bad.want" "$TMP/bad.got"
+done
+
+# Every sample PDA with and without -E. Random strings, plus strings of
+# the shapes the samples accept, built from their own symbols
+for machine in "$SAMPLES"/pda_*.txt; do
+	case $machine in
+		*arithmetic*) alphabet="i()+*" ;;
+		*) alphabet="01" ;;
+	esac
+	awk -v alphabet="$alphabet" 'BEGIN {
+		srand(7);
+		n = length(alphabet);
+		for (r = 0; r < 2000; r++) {
+			len = int(rand() * 14);
+			s = "";
+			for (i = 0; i < len; i++) s = s substr(alphabet, int(rand() * n) + 1, 1);
+			if (r % 4 == 1) {
+				t = "";
+				for (i = length(s); i > 0; i--) t = t substr(s, i, 1);
+				s = s t;
+			} else if (r % 4 == 2) {
+				t = "";
+				for (i = 0; i < len; i++) t = t substr(alphabet, n, 1);
+				s = t;
+				for (i = 0; i < len; i++) s = substr(alphabet, 1, 1) s;
+			} else if (r % 4 == 3 && n > 2) {
+				s = "i";
+				for (i = 0; i < len; i++) {
+					x = rand();
+					if (x < 0.3) s = "(" s ")";
+					else if (x < 0.6) s = s "+i";
+					else s = s "*i";
+				}
+			}
+			print s;
+		}
+	}' > "$TMP/pda.txt"
+	name=$(basename "$machine" .txt)
+	"$TMF" "$machine" -o bit -f "$TMP/pda.txt" > "$TMP/pda.out"
+	"$TMF" "$machine" -E -o bit -f "$TMP/pda.txt" > "$TMP/pda_E.out"
+	same "$name, -E" "$TMP/pda.out" "$TMP/pda_E.out"
+done
+
+# TMs under each exploration strategy. In tm_rejectBranch one branch
+# reaches a reject state while another is still running, which ends only
+# that branch, and a lone branch in a reject state ends the run
+awk 'BEGIN {
+	srand(17);
+	for (r = 0; r < 300; r++) {
+		len = int(rand() * 10) + 1;
+		s = "";
+		for (i = 0; i < len; i++) s = s (rand() < (r % 2 ? 0.5 : 0.9) ? "0" : "1");
+		print s;
+	}
+}' > "$TMP/tm.txt"
+
+for machine in "$(dirname "$0")/tm_rejectBranch.txt" "$SAMPLES/tm_evenPalindrome.txt" \
+	"$SAMPLES/tm_0lenPow2.txt" "$SAMPLES/tm_binaryIncrement.txt"; do
+	name=$(basename "$machine" .txt)
+	"$TMF" "$machine" -t bfs -o bit -f "$TMP/tm.txt" > "$TMP/tm_bfs.out"
+	for strategy in dfs iddfs; do
+		"$TMF" "$machine" -t $strategy -o bit -f "$TMP/tm.txt" > "$TMP/tm_$strategy.out"
+		same "$name, -t $strategy" "$TMP/tm_bfs.out" "$TMP/tm_$strategy.out"
+	done
+done
+
+exit $status
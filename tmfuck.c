@@ -1,25 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <sys/stat.h>
 #include "auto.h"
 #include "regex.h"
 #include "ops.h"
 #include "stack.h"
+#include "dfa.h"
+#include "sink.h"
+#include "batch.h"
+#include "image.h"
+#include "search.h"
 
 int main(int argc, char **argv)
 {
 	char *input_string_file = NULL;
+	char *stream_file = NULL;
 	char *machine_file = NULL;
 	char *input_string = NULL;
 	char *regex = NULL;
+	struct WordList patterns = { 0, 0, NULL };
+	char *save_file = NULL;
+	char *cache_dir = NULL;
+	char *cache_file = NULL;
 
 	int deterministic = 0;
 	int minimize = 0;
 	int config_only = 0;
+	int emit_c = 0;
+	int position = 0;
+	int search = 0;
+	int whole = 0;
+	int output_mode = OUTPUT_FULL;
 
 	int opt;
 	int nonopt_index = 0;
-	while ((opt = getopt (argc, argv, "-:vxcf:r:dms:")) != -1)
+	char *suffix;
+	while ((opt = getopt (argc, argv, "-:vxcgGf:F:wj:o:b:C:L:r:R:pdmEB:t:s:")) != -1)
 	{
 		switch (opt)
 		{
@@ -32,11 +50,63 @@ int main(int argc, char **argv)
 			case 'c':
 				config_only = 1;
 				break;
+			case 'g':
+				emit_c = 1;
+				break;
+			case 'G':
+				search = 1;
+				break;
 			case 'f':
 				input_string_file = optarg;
 				break;
+			case 'F':
+				stream_file = optarg;
+				break;
+			case 'w':
+				whole = 1;
+				break;
+			case 'j':
+				num_threads = atoi(optarg);
+				if (num_threads < 1) {
+					fprintf(stderr, "Option -j requires a positive thread count\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'o':
+				output_mode = Sink_mode(optarg);
+				if (output_mode == -1) {
+					fprintf(stderr, "Unknown output mode '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'b':
+				save_file = optarg;
+				break;
+			case 'C':
+				cache_dir = optarg;
+				break;
+			case 'L':
+				lazy_budget = strtol(optarg, &suffix, 10);
+				if (*suffix == 'k' || *suffix == 'K') lazy_budget <<= 10;
+				else if (*suffix == 'm' || *suffix == 'M') lazy_budget <<= 20;
+				else if (*suffix == 'g' || *suffix == 'G') lazy_budget <<= 30;
+				if (lazy_budget < 1) {
+					fprintf(stderr, "Option -L requires a positive byte count\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'r':
-				regex = optarg;
+				WordList_add(&patterns, strdup(optarg));
+				break;
+			case 'R':
+				WordList_read(&patterns, optarg);
+				if (patterns.len == 0) {
+					fprintf(stderr, "No patterns in %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'p':
+				position = 1;
 				break;
 			case 'd':
 				deterministic = 1;
@@ -44,6 +114,24 @@ int main(int argc, char **argv)
 			case 'm':
 				minimize = 1;
 				break;
+			case 'E':
+				flag_chart = 1;
+				break;
+			case 'B':
+				if (Budget_parse(optarg) == -1) {
+					fprintf(stderr, "Bad budget '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 't':
+				if (!strcmp(optarg, "bfs")) tm_explore = EXPLORE_BFS;
+				else if (!strcmp(optarg, "dfs")) tm_explore = EXPLORE_DFS;
+				else if (!strcmp(optarg, "iddfs")) tm_explore = EXPLORE_IDDFS;
+				else {
+					fprintf(stderr, "Unknown exploration '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 's':
 				delay = atof(optarg);
 				//flag_verbose = 1;
@@ -68,26 +156,76 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (patterns.len > 0) regex = patterns.words[0];
+
 	// if only one nonopt_index with regex assume it's the string
 	if (nonopt_index == 1 && regex) {
 		input_string = machine_file;
 		machine_file = NULL;
 	}
 
-	if (!input_string && !input_string_file &&!config_only) {
+	// Several patterns are run as one set, reporting which ones match
+	int pattern_set = patterns.len > 1 && !machine_file;
+
+	// whole file as one input implies streaming it
+	if (whole && !stream_file) {
+		stream_file = input_string_file;
+		input_string_file = NULL;
+	}
+
+	if (!input_string && !input_string_file && !stream_file && !config_only && !emit_c && !save_file) {
 		fprintf(stderr, "No input string supplied\n");
 		exit(EXIT_FAILURE);
 	}
 		
-	//Automaton_print(a0);
-	struct Automaton *a0;
-	if (regex) {
+	// Cached images are keyed by the machine source and every flag that
+	// changes the machine built from it
+	struct Automaton *a0 = NULL;
+	if (cache_dir) {
+		unsigned long long key = IMAGE_HASH_SEED;
+		int flags[] = { IMAGE_VERSION, deterministic, minimize, config_only, emit_c, position };
+		key = image_hash(key, flags, sizeof(flags));
 		if (machine_file)
-			a0 = Automaton_import(machine_file);
+			key = image_hash_file(key, machine_file);
 		else
-			a0 = regex_to_nfa(regex);
-	} else if (machine_file)
-		a0 = Automaton_import(machine_file);
+			for (int i = 0; i < patterns.len; i++)
+				key = image_hash(key, patterns.words[i], strlen(patterns.words[i]) + 1);
+		mkdir(cache_dir, 0777);
+		cache_file = malloc(strlen(cache_dir) + 32);
+		if (cache_file == NULL) {
+			fprintf(stderr, "Error allocating memory for cache file name\n");
+			exit(EXIT_FAILURE);
+		}
+		sprintf(cache_file, "%s/%016llx.tmfi", cache_dir, key);
+		if (isimage(cache_file)) {
+			a0 = Automaton_load(cache_file);
+			deterministic = 0;
+			minimize = 0;
+			free(cache_file);
+			cache_file = NULL;
+		}
+	}
+
+	//Automaton_print(a0);
+	if (a0 == NULL) {
+		if (pattern_set) {
+			// Only a DFA's states tell which patterns matched, so a set is
+			// always converted
+			struct Automaton *a1 = regex_set_to_nfa(patterns.words, patterns.len, position);
+			a0 = nfa_to_dfa(a1);
+			Automaton_destroy(a1);
+		} else if (regex) {
+			if (machine_file)
+				a0 = Automaton_import(machine_file);
+			else if (position)
+				a0 = regex_to_glushkov(regex);
+			else
+				a0 = regex_to_nfa(regex);
+		} else if (machine_file)
+			a0 = Automaton_import(machine_file);
+	}
+
+	Sink_init(&result_sink, output_mode, stdout);
 
 	// 0 for NFA
 	// 1 for DFA
@@ -95,8 +233,9 @@ int main(int argc, char **argv)
 	// 3 for TM
 	int machine_code = isDFA(a0);
 	
-	if (config_only) {
-		if ( (deterministic || minimize) && machine_code < 2) {
+	if (config_only || emit_c) {
+		// C source can only be emitted for a DFA, so -g implies -d
+		if ( (deterministic || minimize || (emit_c && machine_code == 0)) && machine_code < 2) {
 			struct Automaton *a1 = nfa_to_dfa(a0);
 			Automaton_destroy(a0);
 			if (minimize) {
@@ -106,7 +245,18 @@ int main(int argc, char **argv)
 				a0 = a1;
 			}
 		}
-		Automaton_print(a0);
+		if (cache_file) Automaton_save(a0, cache_file);
+		if (save_file && Automaton_save(a0, save_file) != 0) exit(EXIT_FAILURE);
+		if (emit_c) {
+			if (isDFA(a0) != 1) {
+				fprintf(stderr, "Only a DFA can be emitted as C source\n");
+				exit(EXIT_FAILURE);
+			}
+			if (a0->table == NULL) a0->table = DFATable_create(a0);
+			DFATable_emit(a0->table, stdout);
+		} else {
+			Automaton_print(a0);
+		}
 		Automaton_destroy(a0);
 		return 0;
 	}
@@ -152,7 +302,25 @@ int main(int argc, char **argv)
 		}
 	}
 	
-	if (input_string_file) {
+	if (cache_file) Automaton_save(a0, cache_file);
+	if (save_file && Automaton_save(a0, save_file) != 0) exit(EXIT_FAILURE);
+	
+	// Search mode reads lines from either file option the same way
+	if (search) {
+		char *literal = (regex && !machine_file && !pattern_set) ? regex_literal(regex) : NULL;
+		a0->search = Search_create(a0, literal);
+		free(literal);
+		if (stream_file || input_string_file)
+			Automaton_run_stream(a0, stream_file ? stream_file : input_string_file, whole);
+		else if (input_string)
+			Search_record(a0->search, input_string, strlen(input_string));
+	} else if (stream_file) {
+		if (flag_verbose) Automaton_print(a0);
+		if (num_threads > 1 && !whole)
+			Automaton_run_batch(a0, stream_file, num_threads);
+		else
+			Automaton_run_stream(a0, stream_file, whole);
+	} else if (input_string_file) {
 		if (input_string) {
 			if (machine_code == 1) {
 				if (flag_verbose) Automaton_print(a0);
@@ -164,6 +332,8 @@ int main(int argc, char **argv)
 				if (flag_verbose) Automaton_print(a0);
 				TuringMachine_run(a0, input_string);
 			}
+		} else if (num_threads > 1) {
+			Automaton_run_batch(a0, input_string_file, num_threads);
 		} else {
 			if (flag_verbose) Automaton_print(a0);
 			Automaton_run_file(a0, input_string_file);
@@ -181,5 +351,10 @@ int main(int argc, char **argv)
 		}
 	}
 
+	Sink_finish(&result_sink);
+	Sink_destroy(&result_sink);
 	Automaton_destroy(a0);
+	free(cache_file);
+	for (int i = 0; i < patterns.len; i++) free(patterns.words[i]);
+	free(patterns.words);
 }